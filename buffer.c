@@ -25,8 +25,10 @@
  * covered work.
  */
 
+#include <ctype.h>
 #include <err.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,198 +37,807 @@
 #include <wctype.h>
 
 #include "chat.h"
+#include "width.h"
+
+// Lines are stored in segments allocated as they fill, and freed once all
+// their lines have been dropped from the front. Hard segments are plain
+// arrays of views; soft segments also keep each line's length and wraps.
+enum { SegmentCap = 256 };
+struct Segment {
+	struct Line lines[SegmentCap];
+	uint lens[SegmentCap];
+	struct Wrap *wraps[SegmentCap];
+	size_t stamp;
+	char *block;
+	size_t blockLen;
+	byte *packed;
+	size_t packedLen;
+	byte *trigrams;
+};
 
 struct Lines {
+	size_t head;
+	size_t len;
+	size_t first;
+	size_t count;
+	size_t cap;
+	void **segments;
+};
+
+// Where a soft line breaks into hard lines at a particular width, so that
+// returning to that width doesn't need to flow the line again.
+struct Break {
+	size_t off;
+	size_t len;
+	int align;
+	struct Style style;
+};
+struct Wrap {
+	struct Wrap *next;
+	int cols;
 	size_t len;
-	struct Line lines[BufferCap];
+	struct Break breaks[];
 };
-_Static_assert(!(BufferCap & (BufferCap - 1)), "BufferCap is power of two");
+
+// Each buffer keeps its own budget, since buffers are reflowed in parallel
+// and can only drop their own widths.
+enum { WrapCap = 4 };
+size_t bufferWrapCap = 1024 * 1024;
 
 struct Buffer {
+	size_t cap;
+	size_t epoch;
 	struct Lines soft;
 	struct Lines hard;
+	int widths[WrapCap];
+	size_t wrapSize;
 };
 
-struct Buffer *bufferAlloc(void) {
+struct Buffer *bufferAlloc(size_t cap) {
 	struct Buffer *buffer = calloc(1, sizeof(*buffer));
 	if (!buffer) err(1, "calloc");
+	buffer->cap = cap;
 	return buffer;
 }
 
+static size_t wrapSizeof(const struct Wrap *wrap) {
+	return sizeof(*wrap) + wrap->len * sizeof(wrap->breaks[0]);
+}
+
+static void wrapFree(struct Buffer *buffer, struct Wrap *wrap) {
+	while (wrap) {
+		struct Wrap *next = wrap->next;
+		buffer->wrapSize -= wrapSizeof(wrap);
+		free(wrap);
+		wrap = next;
+	}
+}
+
+static void *linesSegment(const struct Lines *lines, size_t i) {
+	return lines->segments[i / SegmentCap - lines->first];
+}
+
+static struct Line *linesLine(const struct Lines *lines, size_t i) {
+	struct Segment *segment = linesSegment(lines, i);
+	return &segment->lines[i % SegmentCap];
+}
+
+static struct Wrap **linesWrap(const struct Lines *lines, size_t i) {
+	struct Segment *segment = linesSegment(lines, i);
+	return &segment->wraps[i % SegmentCap];
+}
+
+static struct View *linesView(const struct Lines *lines, size_t i) {
+	struct View *views = linesSegment(lines, i);
+	return &views[i % SegmentCap];
+}
+
+// Returns the segment holding the new last line, allocating it of size if
+// the line starts a segment.
+static void *linesNext(struct Lines *lines, size_t size) {
+	size_t i = lines->len++;
+	if (i % SegmentCap && lines->count) return linesSegment(lines, i);
+	if (lines->count == lines->cap) {
+		lines->cap = (lines->cap ? lines->cap * 2 : 4);
+		lines->segments = realloc(
+			lines->segments, sizeof(*lines->segments) * lines->cap
+		);
+		if (!lines->segments) err(1, "realloc");
+	}
+	void *segment = calloc(1, size);
+	if (!segment) err(1, "calloc");
+	if (!lines->count) lines->first = i / SegmentCap;
+	lines->segments[lines->count++] = segment;
+	return segment;
+}
+
+static void segmentFree(void *ptr) {
+	struct Segment *segment = ptr;
+	free(segment->trigrams);
+	free(segment->block);
+	free(segment->packed);
+	free(segment);
+}
+
+static void linesDrop(struct Lines *lines, void (*release)(void *)) {
+	if (++lines->head % SegmentCap && lines->head < lines->len) return;
+	release(lines->segments[0]);
+	lines->count--;
+	lines->first++;
+	memmove(
+		&lines->segments[0], &lines->segments[1],
+		sizeof(*lines->segments) * lines->count
+	);
+}
+
+static void linesClear(struct Lines *lines, void (*release)(void *)) {
+	for (size_t i = 0; i < lines->count; ++i) {
+		release(lines->segments[i]);
+	}
+	free(lines->segments);
+	*lines = (struct Lines) {0};
+}
+
+// Soft lines in segments older than the newest few which haven't been looked
+// at recently are compressed together. Compressed segments are decompressed
+// when they're looked at again, and the decompressed copy is dropped the
+// next time they go cold.
+enum { SegmentHot = 2 };
+
+static void segmentFreeze(struct Segment *segment) {
+	if (segment->packed) {
+		free(segment->block);
+		segment->block = NULL;
+		for (size_t i = 0; i < SegmentCap; ++i) {
+			segment->lines[i].str = NULL;
+		}
+		return;
+	}
+
+	size_t len = 0;
+	for (size_t i = 0; i < SegmentCap; ++i) {
+		len += segment->lens[i] + 1;
+	}
+	char *block = malloc(len);
+	if (!block) err(1, "malloc");
+	char *ptr = block;
+	for (size_t i = 0; i < SegmentCap; ++i) {
+		struct Line *line = &segment->lines[i];
+		if (line->str) {
+			memcpy(ptr, line->str, segment->lens[i] + 1);
+		} else {
+			memset(ptr, 0, segment->lens[i] + 1);
+		}
+		ptr += segment->lens[i] + 1;
+		free(line->str);
+		line->str = NULL;
+	}
+
+	size_t cap = lzBound(len);
+	segment->packed = malloc(cap);
+	if (!segment->packed) err(1, "malloc");
+	segment->packedLen = lzPack(segment->packed, cap, (byte *)block, len);
+	if (!segment->packedLen) errx(1, "lzPack");
+	segment->packed = realloc(segment->packed, segment->packedLen);
+	if (!segment->packed) err(1, "realloc");
+	segment->blockLen = len;
+	free(block);
+}
+
+static void segmentThaw(struct Segment *segment) {
+	segment->block = malloc(segment->blockLen);
+	if (!segment->block) err(1, "malloc");
+	int error = lzUnpack(
+		(byte *)segment->block, segment->blockLen,
+		segment->packed, segment->packedLen
+	);
+	if (error) errx(1, "corrupt scrollback segment");
+	char *ptr = segment->block;
+	for (size_t i = 0; i < SegmentCap; ++i) {
+		segment->lines[i].str = ptr;
+		ptr += segment->lens[i] + 1;
+	}
+}
+
+static void freeze(struct Buffer *buffer) {
+	for (size_t i = 0; i + SegmentHot < buffer->soft.count; ++i) {
+		struct Segment *segment = buffer->soft.segments[i];
+		if (segment->packed && !segment->block) continue;
+		if (buffer->epoch - segment->stamp < 2) continue;
+		segmentFreeze(segment);
+	}
+	buffer->epoch++;
+}
+
+static struct Line *softLine(const struct Buffer *buffer, size_t i) {
+	struct Segment *segment = linesSegment(&buffer->soft, i);
+	if (segment->packed && !segment->block) segmentThaw(segment);
+	return &segment->lines[i % SegmentCap];
+}
+
 void bufferFree(struct Buffer *buffer) {
-	for (size_t i = 0; i < BufferCap; ++i) {
-		free(buffer->soft.lines[i].str);
-		free(buffer->hard.lines[i].str);
+	for (size_t i = buffer->soft.head; i < buffer->soft.len; ++i) {
+		struct Segment *segment = linesSegment(&buffer->soft, i);
+		if (!segment->packed) free(linesLine(&buffer->soft, i)->str);
+		wrapFree(buffer, *linesWrap(&buffer->soft, i));
 	}
+	linesClear(&buffer->soft, segmentFree);
+	linesClear(&buffer->hard, free);
 	free(buffer);
 }
 
-static const struct Line *linesLine(const struct Lines *lines, size_t i) {
-	const struct Line *line = &lines->lines[(lines->len + i) % BufferCap];
-	return (line->str ? line : NULL);
+size_t bufferSoftLen(const struct Buffer *buffer) {
+	return buffer->soft.len - buffer->soft.head;
 }
 
-static struct Line *linesNext(struct Lines *lines) {
-	struct Line *line = &lines->lines[lines->len++ % BufferCap];
-	free(line->str);
-	return line;
+size_t bufferHardLen(const struct Buffer *buffer) {
+	return buffer->hard.len - buffer->hard.head;
 }
 
 const struct Line *bufferSoft(const struct Buffer *buffer, size_t i) {
-	return linesLine(&buffer->soft, i);
+	if (i >= bufferSoftLen(buffer)) return NULL;
+	i += buffer->soft.head;
+	struct Segment *segment = linesSegment(&buffer->soft, i);
+	segment->stamp = buffer->epoch;
+	return softLine(buffer, i);
 }
 
-const struct Line *bufferHard(const struct Buffer *buffer, size_t i) {
-	return linesLine(&buffer->hard, i);
+// Walks over the whole buffer, such as for saving or searching, read through
+// bufferPeek so they don't warm every segment, then call bufferCool to drop
+// the decompressed copies of segments that weren't otherwise looked at.
+const struct Line *bufferPeek(const struct Buffer *buffer, size_t i) {
+	if (i >= bufferSoftLen(buffer)) return NULL;
+	return softLine(buffer, i + buffer->soft.head);
 }
 
-enum { StyleCap = 10 };
-static char *styleCopy(char *ptr, char *end, struct Style style) {
-	ptr = seprintf(
-		ptr, end, "%s%s%s%s",
-		(style.attr & Bold ? (const char []) { B, '\0' } : ""),
-		(style.attr & Reverse ? (const char []) { R, '\0' } : ""),
-		(style.attr & Italic ? (const char []) { I, '\0' } : ""),
-		(style.attr & Underline ? (const char []) { U, '\0' } : "")
-	);
-	if (style.fg != Default || style.bg != Default) {
-		ptr = seprintf(ptr, end, "\3%02d,%02d", style.fg, style.bg);
+void bufferCool(struct Buffer *buffer) {
+	for (size_t i = 0; i + SegmentHot < buffer->soft.count; ++i) {
+		struct Segment *segment = buffer->soft.segments[i];
+		if (!segment->packed || !segment->block) continue;
+		if (buffer->epoch - segment->stamp < 2) continue;
+		segmentFreeze(segment);
 	}
-	return ptr;
 }
 
-static const wchar_t ZWS = L'\u200B';
-static const wchar_t ZWNJ = L'\u200C';
+// The soft line might have been compressed since the view was made, so it's
+// looked at to decompress it again.
+const struct View *bufferHard(const struct Buffer *buffer, size_t i) {
+	if (i >= bufferHardLen(buffer)) return NULL;
+	const struct View *view = linesView(&buffer->hard, buffer->hard.head + i);
+	bufferSoft(buffer, view->line->num - 1 - buffer->soft.head);
+	return view;
+}
 
-static int flow(struct Lines *hard, int cols, const struct Line *soft) {
-	int flowed = 1;
+// Hard lines are views into soft lines, so they're dropped along with them.
+static void softDrop(struct Buffer *buffer) {
+	struct Line *soft = linesLine(&buffer->soft, buffer->soft.head);
+	while (buffer->hard.head < buffer->hard.len) {
+		const struct View *view = linesView(&buffer->hard, buffer->hard.head);
+		if (view->line != soft) break;
+		linesDrop(&buffer->hard, free);
+	}
+	struct Segment *segment = linesSegment(&buffer->soft, buffer->soft.head);
+	if (!segment->packed) free(soft->str);
+	soft->str = NULL;
+	wrapFree(buffer, *linesWrap(&buffer->soft, buffer->soft.head));
+	linesDrop(&buffer->soft, segmentFree);
+}
 
-	struct Line *line = linesNext(hard);
-	line->num = soft->num;
-	line->heat = soft->heat;
-	line->time = soft->time;
-	line->str = strdup(soft->str);
-	if (!line->str) err(1, "strdup");
+void bufferTrim(struct Buffer *buffer, size_t cap) {
+	buffer->cap = cap;
+	while (bufferSoftLen(buffer) > cap) {
+		softDrop(buffer);
+	}
+}
+
+// ASCII is decoded without going through the locale.
+static int decode(wchar_t *wc, const char *str, size_t len) {
+	if (!(*str & '\200')) {
+		*wc = *str;
+		return 1;
+	}
+	mbstate_t state;
+	memset(&state, 0, sizeof(state));
+	size_t n = mbrtowc(wc, str, len, &state);
+	return (n > len ? -1 : (int)n);
+}
+
+static bool space(wchar_t wc) {
+	if (wc < 0x80) return wc == L' ' || (wc >= L'\t' && wc <= L'\r');
+	return iswspace(wc);
+}
+
+// Widths of printable characters, from the table in width.h rather than
+// the locale.
+static int charWidth(wchar_t wc) {
+	if (wc < 0x80) return 1;
+	size_t lo = 0, hi = ARRAY_LEN(Widths);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ((uint32_t)wc < Widths[mid].lo) {
+			hi = mid;
+		} else if ((uint32_t)wc > Widths[mid].hi) {
+			lo = mid + 1;
+		} else {
+			return Widths[mid].width;
+		}
+	}
+	return 1;
+}
+
+// Returns the length of the leading run of printable ASCII other than space
+// and hyphen, which can't be broken, checking a word at a time.
+static size_t plain(const char *str, size_t len) {
+	const uint64_t ones = 0x0101010101010101;
+	const uint64_t highs = 0x8080808080808080;
+	size_t n = 0;
+	for (; n + sizeof(uint64_t) <= len; n += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, &str[n], sizeof(word));
+		uint64_t bad = word
+			| (word - ones * ' ' - ones)
+			| ((word ^ ones * '-') - ones)
+			| ((word ^ ones * '\177') - ones);
+		if (bad & highs) break;
+	}
+	while (n < len && str[n] > ' ' && str[n] < '\177' && str[n] != '-') {
+		n++;
+	}
+	return n;
+}
+
+// Each segment of soft lines has a bit set of the trigrams in its lines,
+// ignoring case, which searches check before looking at its lines.
+enum { TrigramBits = 15 };
+
+static uint trigram(const char *str) {
+	uint32_t key = (uint32_t)tolower((byte)str[0]) << 16
+		| (uint32_t)tolower((byte)str[1]) << 8
+		| (uint32_t)tolower((byte)str[2]);
+	return (key * 0x9E3779B1) >> (32 - TrigramBits);
+}
+
+static void trigramAdd(struct Segment *segment, const char *str) {
+	if (!segment->trigrams) {
+		segment->trigrams = calloc(1, 1 << TrigramBits >> 3);
+		if (!segment->trigrams) err(1, "calloc");
+	}
+	for (; str[0] && str[1] && str[2]; ++str) {
+		uint bit = trigram(str);
+		segment->trigrams[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+static bool trigramHas(const struct Segment *segment, const char *str) {
+	if (!segment->trigrams) return false;
+	for (; str[0] && str[1] && str[2]; ++str) {
+		uint bit = trigram(str);
+		if (!(segment->trigrams[bit >> 3] & 1 << (bit & 7))) return false;
+	}
+	return true;
+}
+
+size_t bufferFind(const struct Buffer *buffer, size_t i, const char *str) {
+	size_t len = bufferSoftLen(buffer);
+	for (i += buffer->soft.head; i < buffer->soft.len;) {
+		if (!trigramHas(linesSegment(&buffer->soft, i), str)) {
+			i += SegmentCap - i % SegmentCap;
+			continue;
+		}
+		if (strcasestr(softLine(buffer, i)->str, str)) {
+			return i - buffer->soft.head;
+		}
+		i++;
+	}
+	return len;
+}
+
+static struct Wrap *wrapPush(struct Wrap *wrap, size_t *cap, struct Break brk) {
+	if (wrap->len == *cap) {
+		*cap *= 2;
+		wrap = realloc(wrap, sizeof(*wrap) + *cap * sizeof(brk));
+		if (!wrap) err(1, "realloc");
+	}
+	wrap->breaks[wrap->len++] = brk;
+	return wrap;
+}
+
+static struct Wrap *flow(int cols, const char *soft) {
+	size_t cap = 2;
+	struct Wrap *wrap = malloc(sizeof(*wrap) + cap * sizeof(wrap->breaks[0]));
+	if (!wrap) err(1, "malloc");
+	wrap->next = NULL;
+	wrap->cols = cols;
+	wrap->len = 0;
+
+	struct Break line = { .style = StyleDefault };
 
 	int width = 0;
 	int align = 0;
-	char *wrap = NULL;
+	bool tabbed = false;
+	const char *brk = NULL;
 	struct Style style = StyleDefault;
-	struct Style wrapStyle = StyleDefault;
-	for (char *str = line->str; *str;) {
-		size_t len = styleParse(&style, (const char **)&str);
+	struct Style brkStyle = StyleDefault;
+	for (const char *str = soft; *str;) {
+		size_t len = styleParse(&style, &str);
 		if (!len) continue;
 
-		bool tab = (*str == '\t' && !align);
-		if (tab) *str = ' ';
+		// Runs which can't be broken fit whole up to cols.
+		if (width < cols) {
+			size_t n = plain(str, len);
+			if (n > (size_t)(cols - width)) n = cols - width;
+			if (n) {
+				width += n;
+				str += n;
+				continue;
+			}
+		}
+
+		// The first tab is rendered as a space, and aligns the lines below.
+		bool tab = (*str == '\t' && !tabbed);
+		if (tab) tabbed = true;
 
 		wchar_t wc = L'\0';
-		int n = mbtowc(&wc, str, len);
+		int n = decode(&wc, str, len);
 		if (n < 0) {
 			n = 1;
 			// ncurses will render these as "~A".
 			width += (*str & '\200' ? 2 : 1);
-		} else if (wc == ZWS || wc == ZWNJ) {
-			// ncurses likes to render these as spaces when they should be
-			// zero-width, so just remove them entirely.
-			memmove(str, &str[n], strlen(&str[n]) + 1);
-			continue;
+		} else if (tab) {
+			width++;
 		} else if (wc == L'\t') {
 			// Assuming TABSIZE = 8.
 			width += 8 - (width % 8);
 		} else if (wc < L' ' || wc == L'\177') {
 			// ncurses will render these as "^A".
 			width += 2;
-		} else if (wcwidth(wc) > 0) {
-			width += wcwidth(wc);
+		} else {
+			width += charWidth(wc);
 		}
 
 		if (tab && width < cols) {
 			align = width;
-			wrap = NULL;
+			brk = NULL;
 		}
-		if (iswspace(wc) && !tab) {
-			wrap = str;
-			wrapStyle = style;
+		if (space(wc) && !tab) {
+			brk = str;
+			brkStyle = style;
 		}
 		if (wc == L'-' && width <= cols) {
-			wrap = &str[n];
-			wrapStyle = style;
+			brk = &str[n];
+			brkStyle = style;
 		}
 
 		if (width <= cols) {
 			str += n;
 			continue;
-		} else if (!wrap) {
-			wrap = str;
-			wrapStyle = style;
+		} else if (!brk) {
+			// Always make progress, even if a character is wider than cols.
+			brk = (str == &soft[line.off] ? &str[n] : str);
+			brkStyle = style;
 		}
 
 		n = 0;
-		len = strlen(wrap);
-		for (int m; wrap[n] && (m = mbtowc(&wc, &wrap[n], len - n)); n += m) {
+		len = strlen(brk);
+		for (int m; brk[n] && (m = decode(&wc, &brk[n], len - n)); n += m) {
 			if (m < 0) {
 				m = 1;
-			} else if (!iswspace(wc)) {
+			} else if (!space(wc)) {
 				break;
 			}
 		}
-		if (!wrap[n]) {
-			*wrap = '\0';
-			break;
-		}
+		line.len = brk - &soft[line.off];
+		wrap = wrapPush(wrap, &cap, line);
+		if (!brk[n]) return wrap;
 
-		flowed++;
-		line = linesNext(hard);
-		line->num = soft->num;
-		line->heat = soft->heat;
-		line->time = 0;
+		line.off = &brk[n] - soft;
+		line.align = align;
+		line.style = brkStyle;
+		str = &brk[n];
+		style = brkStyle;
+		width = align;
+		brk = NULL;
+	}
 
-		size_t cap = StyleCap + align + strlen(&wrap[n]) + 1;
-		line->str = malloc(cap);
-		if (!line->str) err(1, "malloc");
+	line.len = strlen(&soft[line.off]);
+	return wrapPush(wrap, &cap, line);
+}
 
-		char *end = &line->str[cap];
-		str = seprintf(line->str, end, "%*s", (width = align), "");
-		str = styleCopy(str, end, wrapStyle);
-		style = wrapStyle;
-		seprintf(str, end, "%s", &wrap[n]);
+static int
+emit(struct Lines *hard, const struct Line *soft, const struct Wrap *wrap) {
+	for (size_t i = 0; i < wrap->len; ++i) {
+		const struct Break *brk = &wrap->breaks[i];
+		size_t j = hard->len;
+		struct View *views = linesNext(hard, sizeof(struct View[SegmentCap]));
+		views[j % SegmentCap] = (struct View) {
+			.line = soft,
+			.off = brk->off,
+			.len = brk->len,
+			.align = brk->align,
+			.style = brk->style,
+		};
+	}
+	return wrap->len;
+}
 
-		*wrap = '\0';
-		wrap = NULL;
+static void widthDrop(struct Buffer *buffer, int cols) {
+	for (size_t i = buffer->soft.head; i < buffer->soft.len; ++i) {
+		for (struct Wrap **wrap = linesWrap(&buffer->soft, i); *wrap;) {
+			if ((*wrap)->cols != cols) {
+				wrap = &(*wrap)->next;
+				continue;
+			}
+			struct Wrap *next = (*wrap)->next;
+			(*wrap)->next = NULL;
+			wrapFree(buffer, *wrap);
+			*wrap = next;
+		}
+	}
+}
+
+static void widthTouch(struct Buffer *buffer, int cols) {
+	if (buffer->widths[0] == cols) return;
+	size_t i;
+	for (i = 1; i < WrapCap - 1; ++i) {
+		if (buffer->widths[i] == cols) break;
+	}
+	if (buffer->widths[i] != cols && buffer->widths[i]) {
+		widthDrop(buffer, buffer->widths[i]);
 	}
+	memmove(&buffer->widths[1], &buffer->widths[0], sizeof(cols) * i);
+	buffer->widths[0] = cols;
+}
 
+static bool wrapBudget(struct Buffer *buffer, size_t size) {
+	for (size_t i = WrapCap - 1; i > 0; --i) {
+		if (buffer->wrapSize + size <= bufferWrapCap) break;
+		if (!buffer->widths[i]) continue;
+		widthDrop(buffer, buffer->widths[i]);
+		buffer->widths[i] = 0;
+	}
+	return buffer->wrapSize + size <= bufferWrapCap;
+}
+
+static int wrap(struct Buffer *buffer, int cols, size_t i) {
+	const struct Line *soft = linesLine(&buffer->soft, i);
+	struct Wrap **wraps = linesWrap(&buffer->soft, i);
+	for (struct Wrap *wrap = *wraps; wrap; wrap = wrap->next) {
+		if (wrap->cols == cols) return emit(&buffer->hard, soft, wrap);
+	}
+	struct Wrap *wrap = flow(cols, softLine(buffer, i)->str);
+	int flowed = emit(&buffer->hard, soft, wrap);
+	if (wrapBudget(buffer, wrapSizeof(wrap))) {
+		buffer->wrapSize += wrapSizeof(wrap);
+		wrap->next = *wraps;
+		*wraps = wrap;
+	} else {
+		free(wrap);
+	}
 	return flowed;
 }
 
-int bufferPush(
-	struct Buffer *buffer, int cols, enum Heat thresh,
-	enum Heat heat, time_t time, const char *str
+static size_t softPush(
+	struct Buffer *buffer, enum Heat heat, time_t time, const char *str
 ) {
-	struct Line *soft = linesNext(&buffer->soft);
+	if (bufferSoftLen(buffer) >= buffer->cap) softDrop(buffer);
+	if (!(buffer->soft.len % SegmentCap)) freeze(buffer);
+
+	size_t i = buffer->soft.len;
+	struct Segment *segment = linesNext(&buffer->soft, sizeof(*segment));
+	struct Line *soft = &segment->lines[i % SegmentCap];
 	soft->num = buffer->soft.len;
 	soft->heat = heat;
 	soft->time = time;
 	soft->str = strdup(str);
 	if (!soft->str) err(1, "strdup");
+	segment->lens[i % SegmentCap] = strlen(soft->str);
+	trigramAdd(segment, soft->str);
+	return i;
+}
+
+int bufferPush(
+	struct Buffer *buffer, int cols, enum Heat thresh,
+	enum Heat heat, time_t time, const char *str
+) {
+	size_t i = softPush(buffer, heat, time, str);
 	if (heat < thresh) return 0;
-	return flow(&buffer->hard, cols, soft);
+	widthTouch(buffer, cols);
+	return wrap(buffer, cols, i);
+}
+
+// Adds a line without flowing it. The hard lines are out of date until the
+// buffer is next reflowed.
+void bufferLoad(
+	struct Buffer *buffer, enum Heat heat, time_t time, const char *str
+) {
+	softPush(buffer, heat, time, str);
 }
 
 int
 bufferReflow(struct Buffer *buffer, int cols, enum Heat thresh, size_t tail) {
-	buffer->hard.len = 0;
-	for (size_t i = 0; i < BufferCap; ++i) {
-		free(buffer->hard.lines[i].str);
-		buffer->hard.lines[i].str = NULL;
-	}
+	linesClear(&buffer->hard, free);
+	widthTouch(buffer, cols);
 	int flowed = 0;
-	for (size_t i = 0; i < BufferCap; ++i) {
-		const struct Line *soft = bufferSoft(buffer, i);
-		if (!soft) continue;
-		if (soft->heat < thresh) continue;
-		int n = flow(&buffer->hard, cols, soft);
-		if (i >= BufferCap - tail) flowed += n;
+	size_t len = bufferSoftLen(buffer);
+	for (size_t i = 0; i < len; ++i) {
+		size_t j = buffer->soft.head + i;
+		if (linesLine(&buffer->soft, j)->heat < thresh) continue;
+		int n = wrap(buffer, cols, j);
+		if (i + tail >= len) flowed += n;
 	}
+	freeze(buffer);
 	return flowed;
 }
+
+#ifdef TEST
+#undef NDEBUG
+#include <assert.h>
+#include <locale.h>
+
+// The wrapping kernel before the ASCII fast path and width table.
+static struct Wrap *flowSlow(int cols, const char *soft) {
+	size_t cap = 2;
+	struct Wrap *wrap = malloc(sizeof(*wrap) + cap * sizeof(wrap->breaks[0]));
+	if (!wrap) err(1, "malloc");
+	wrap->next = NULL;
+	wrap->cols = cols;
+	wrap->len = 0;
+
+	struct Break line = { .style = StyleDefault };
+
+	int width = 0;
+	int align = 0;
+	bool tabbed = false;
+	const char *brk = NULL;
+	struct Style style = StyleDefault;
+	struct Style brkStyle = StyleDefault;
+	for (const char *str = soft; *str;) {
+		size_t len = styleParse(&style, &str);
+		if (!len) continue;
+
+		// The first tab is rendered as a space, and aligns the lines below.
+		bool tab = (*str == '\t' && !tabbed);
+		if (tab) tabbed = true;
+
+		wchar_t wc = L'\0';
+		int n = mbtowc(&wc, str, len);
+		if (n < 0) {
+			n = 1;
+			// ncurses will render these as "~A".
+			width += (*str & '\200' ? 2 : 1);
+		} else if (tab) {
+			width++;
+		} else if (wc == L'\t') {
+			// Assuming TABSIZE = 8.
+			width += 8 - (width % 8);
+		} else if (wc < L' ' || wc == L'\177') {
+			// ncurses will render these as "^A".
+			width += 2;
+		} else if (wcwidth(wc) > 0) {
+			width += wcwidth(wc);
+		}
+
+		if (tab && width < cols) {
+			align = width;
+			brk = NULL;
+		}
+		if (iswspace(wc) && !tab) {
+			brk = str;
+			brkStyle = style;
+		}
+		if (wc == L'-' && width <= cols) {
+			brk = &str[n];
+			brkStyle = style;
+		}
+
+		if (width <= cols) {
+			str += n;
+			continue;
+		} else if (!brk) {
+			// Always make progress, even if a character is wider than cols.
+			brk = (str == &soft[line.off] ? &str[n] : str);
+			brkStyle = style;
+		}
+
+		n = 0;
+		len = strlen(brk);
+		for (int m; brk[n] && (m = mbtowc(&wc, &brk[n], len - n)); n += m) {
+			if (m < 0) {
+				m = 1;
+			} else if (!iswspace(wc)) {
+				break;
+			}
+		}
+		line.len = brk - &soft[line.off];
+		wrap = wrapPush(wrap, &cap, line);
+		if (!brk[n]) return wrap;
+
+		line.off = &brk[n] - soft;
+		line.align = align;
+		line.style = brkStyle;
+		str = &brk[n];
+		style = brkStyle;
+		width = align;
+		brk = NULL;
+	}
+
+	line.len = strlen(&soft[line.off]);
+	return wrapPush(wrap, &cap, line);
+}
+
+// Truncated sequences are left out, since mbtowc(3) carries them over into
+// the next call.
+static const char *Pieces[] = {
+	"a", "word", "longerword", " ", "  ", "-", "--", "\t", "\n", "\1",
+	"\177", "\2", "\3" "4", "\3" "04,08", "\17", "\26", "\35", "\37",
+	"\xC3\xA9", "\xE6\xBC\xA2\xE5\xAD\x97", "\xEF\xBC\xA1",
+	"\xCC\x81", "\xC2\x85", "\xE3\x80\x80", "\xE2\x80\x83",
+	"\xF0\x9F\x98\xBA", "\xFF",
+};
+
+static uint32_t seed = 1;
+static uint32_t rng(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+int main(void) {
+	if (!setlocale(LC_CTYPE, "C.UTF-8")) return 0;
+	for (int i = 0; i < 50000; ++i) {
+		char soft[1024] = "";
+		for (uint32_t n = rng() % 64; n; --n) {
+			strcat(soft, Pieces[rng() % ARRAY_LEN(Pieces)]);
+		}
+		int cols = 1 + rng() % 80;
+		struct Wrap *fast = flow(cols, soft);
+		struct Wrap *slow = flowSlow(cols, soft);
+		assert(fast->len == slow->len);
+		for (size_t j = 0; j < fast->len; ++j) {
+			struct Break a = fast->breaks[j], b = slow->breaks[j];
+			assert(a.off == b.off && a.len == b.len && a.align == b.align);
+			assert(a.style.attr == b.style.attr);
+			assert(a.style.fg == b.style.fg && a.style.bg == b.style.bg);
+		}
+		free(fast);
+		free(slow);
+	}
+
+	struct Buffer *buffer = bufferAlloc(SIZE_MAX);
+	for (int i = 0; i < 8 * SegmentCap; ++i) {
+		char str[16];
+		snprintf(str, sizeof(str), "line %d", i);
+		bufferPush(buffer, 80, Cold, Cold, 0, str);
+	}
+	struct Segment *segment = buffer->soft.segments[0];
+	assert(segment->packed && !segment->block);
+	assert(!strcmp(bufferPeek(buffer, 1)->str, "line 1"));
+	assert(segment->block);
+	bufferCool(buffer);
+	assert(!segment->block);
+	assert(!strcmp(bufferSoft(buffer, 1)->str, "line 1"));
+	bufferCool(buffer);
+	assert(segment->block);
+	bufferFree(buffer);
+
+	buffer = bufferAlloc(SIZE_MAX);
+	bufferPush(buffer, 80, Cold, Cold, 0, "zero\u200Bwidth");
+	assert(!strcmp(bufferSoft(buffer, 0)->str, "zero\u200Bwidth"));
+	bufferFree(buffer);
+
+	bufferWrapCap = 64 * 1024;
+	struct Buffer *other = bufferAlloc(SIZE_MAX);
+	buffer = bufferAlloc(SIZE_MAX);
+	for (int i = 0; i < 4 * SegmentCap; ++i) {
+		bufferPush(other, 80, Cold, Cold, 0, "a line of a few words");
+		bufferPush(buffer, 80, Cold, Cold, 0, "a line of a few words");
+	}
+	for (int cols = 10; cols < 20; ++cols) {
+		bufferReflow(buffer, cols, Cold, 0);
+		assert(buffer->wrapSize <= bufferWrapCap);
+	}
+	assert(other->wrapSize && other->wrapSize <= bufferWrapCap);
+	bufferFree(other);
+	bufferFree(buffer);
+}
+
+#endif
@@ -124,6 +124,46 @@ static void utilRead(void) {
 	}
 }
 
+static int fifo = -1;
+
+static void fifoOpen(const char *path) {
+	int error = mkfifo(path, 0600);
+	if (error && errno != EEXIST) err(1, "%s", path);
+	fifo = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fifo < 0) err(1, "%s", path);
+
+	struct stat st;
+	error = fstat(fifo, &st);
+	if (error) err(1, "%s", path);
+	if (!S_ISFIFO(st.st_mode)) errx(1, "%s: not a FIFO", path);
+
+	// Hold the FIFO open for writing so that it never reads as closed
+	// between one writer and the next.
+	int hold = open(path, O_WRONLY | O_CLOEXEC);
+	if (hold < 0) err(1, "%s", path);
+}
+
+static void fifoRead(void) {
+	static char buf[4096];
+	static size_t len;
+	ssize_t n = read(fifo, &buf[len], sizeof(buf) - 1 - len);
+	if (n < 0 && errno == EAGAIN) return;
+	if (n < 0) err(1, "read");
+	len += n;
+	buf[len] = '\0';
+
+	char *ptr = buf;
+	for (char *end; NULL != (end = strchr(ptr, '\n')); ptr = &end[1]) {
+		*end = '\0';
+		if (end > ptr && end[-1] == '\r') end[-1] = '\0';
+		if (ptr[0]) command(Network, ptr);
+	}
+	len -= ptr - buf;
+	memmove(buf, ptr, len);
+	// Drop a line too long to ever be completed.
+	if (len == sizeof(buf) - 1) len = 0;
+}
+
 static void parseEdit(const char *str) {
 	if (!strcmp(str, "emacs")) {
 		inputMode = InputEmacs;
@@ -173,6 +213,14 @@ static void parseHash(char *str) {
 	if (*str) hashBound = strtoul(&str[1], NULL, 0);
 }
 
+static void parseScrollback(char *arg) {
+	char *str;
+	size_t cap = strtoul(arg, &str, 10);
+	if (!cap) errx(1, "invalid scrollback %s", arg);
+	str += strspn(str, " ");
+	windowScrollback((*str ? idFor(str) : None), cap);
+}
+
 static void parsePlain(char *str) {
 	self.plainUser = strsep(&str, ":");
 	if (!str) errx(1, "SASL PLAIN missing colon");
@@ -184,7 +232,7 @@ static void signalHandler(int signal) {
 	signals[signal] = 1;
 }
 
-static void sandboxEarly(bool log);
+static void sandboxEarly(bool log, bool save);
 static void sandboxLate(int irc);
 
 #if defined __OpenBSD__
@@ -192,16 +240,17 @@ static void sandboxLate(int irc);
 static char *promisesInitial;
 static char promises[64] = "stdio tty";
 
-static void sandboxEarly(bool log) {
+static void sandboxEarly(bool log, bool save) {
 	char *ptr = &promises[strlen(promises)];
 	char *end = &promises[sizeof(promises)];
 
+	// The directory of the save file is unveiled by uiLoad().
 	if (log) {
 		char buf[PATH_MAX];
-		int error = unveil(dataPath(buf, sizeof(buf), "log", 0), "wc");
+		int error = unveil(dataPath(buf, sizeof(buf), "log", 0), "rwc");
 		if (error) err(1, "unveil");
-		ptr = seprintf(ptr, end, " wpath cpath");
 	}
+	if (log || save) ptr = seprintf(ptr, end, " rpath wpath cpath");
 
 	if (!self.restricted) {
 		int error = unveil("/", "x");
@@ -224,8 +273,9 @@ static void sandboxLate(int irc) {
 
 #elif defined __FreeBSD__
 
-static void sandboxEarly(bool log) {
+static void sandboxEarly(bool log, bool save) {
 	(void)log;
+	(void)save;
 }
 
 static void sandboxLate(int irc) {
@@ -254,8 +304,9 @@ static void sandboxLate(int irc) {
 }
 
 #else
-static void sandboxEarly(bool log) {
+static void sandboxEarly(bool log, bool save) {
 	(void)log;
+	(void)save;
 }
 static void sandboxLate(int irc) {
 	(void)irc;
@@ -273,6 +324,7 @@ int main(int argc, char *argv[]) {
 	const char *trust = NULL;
 	const char *cert = NULL;
 	const char *priv = NULL;
+	const char *headless = NULL;
 
 	bool log = false;
 	bool sasl = false;
@@ -283,16 +335,23 @@ int main(int argc, char *argv[]) {
 	struct option options[] = {
 		{ .val = '!', .name = "insecure", no_argument },
 		{ .val = 'C', .name = "copy", required_argument },
+		{ .val = 'D', .name = "direct", no_argument },
 		{ .val = 'E', .name = "edit", required_argument },
+		{ .val = 'F', .name = "frame-rate", required_argument },
 		{ .val = 'H', .name = "hash", required_argument },
 		{ .val = 'I', .name = "highlight", required_argument },
+		{ .val = 'L', .name = "log-flush", required_argument },
 		{ .val = 'N', .name = "notify", required_argument },
 		{ .val = 'O', .name = "open", required_argument },
 		{ .val = 'R', .name = "restrict", no_argument },
 		{ .val = 'S', .name = "bind", required_argument },
 		{ .val = 'T', .name = "timestamp", optional_argument },
+		{ .val = 'W', .name = "wrap-cache", required_argument },
+		{ .val = 'Z', .name = "log-compress", required_argument },
 		{ .val = 'a', .name = "sasl-plain", required_argument },
+		{ .val = 'b', .name = "scrollback", required_argument },
 		{ .val = 'c', .name = "cert", required_argument },
+		{ .val = 'd', .name = "headless", required_argument },
 		{ .val = 'e', .name = "sasl-external", no_argument },
 		{ .val = 'g', .name = "generate", required_argument },
 		{ .val = 'h', .name = "host", required_argument },
@@ -325,10 +384,13 @@ int main(int argc, char *argv[]) {
 		switch (opt) {
 			break; case '!': insecure = true;
 			break; case 'C': utilPush(&urlCopyUtil, optarg);
+			break; case 'D': uiDirect = true;
 			break; case 'E': editSet = true; parseEdit(optarg);
+			break; case 'F': uiFrameRate = strtoul(optarg, NULL, 10);
 			break; case 'H': parseHash(optarg);
 			break; case 'I': filterAdd(Hot, optarg);
-			break; case 'N': utilPush(&uiNotifyUtil, optarg);
+			break; case 'L': logFlushDelay = strtoul(optarg, NULL, 10);
+			break; case 'N': utilPush(&notifyUtil, optarg);
 			break; case 'O': utilPush(&urlOpenUtil, optarg);
 			break; case 'R': self.restricted = true;
 			break; case 'S': bind = optarg;
@@ -336,8 +398,12 @@ int main(int argc, char *argv[]) {
 				windowTime.enable = true;
 				if (optarg) windowTime.format = optarg;
 			}
+			break; case 'W': bufferWrapCap = strtoul(optarg, NULL, 10) * 1024;
+			break; case 'Z': utilPush(&logCompressUtil, optarg);
 			break; case 'a': sasl = true; parsePlain(optarg);
+			break; case 'b': parseScrollback(optarg);
 			break; case 'c': cert = optarg;
+			break; case 'd': self.headless = true; headless = optarg;
 			break; case 'e': sasl = true;
 			break; case 'g': genCert(optarg);
 			break; case 'h': host = optarg;
@@ -412,13 +478,18 @@ int main(int argc, char *argv[]) {
 
 	ircConfig(insecure, trust, cert, priv);
 
-	uiInit();
-	sig_t cursesWinch = signal(SIGWINCH, signalHandler);
-	if (save) {
-		uiLoad(save);
-		atexit(exitSave);
+	sig_t cursesWinch = SIG_DFL;
+	if (self.headless) {
+		fifoOpen(headless);
+	} else {
+		uiInit();
+		cursesWinch = signal(SIGWINCH, signalHandler);
+		if (save) {
+			uiLoad(save);
+			atexit(exitSave);
+		}
+		windowShow(windowFor(Network));
 	}
-	windowShow(windowFor(Network));
 	uiFormat(
 		Network, Cold, NULL,
 		"\3%dcatgirl\3\tis GPLv3 fwee softwawe ^w^  "
@@ -428,7 +499,7 @@ int main(int argc, char *argv[]) {
 	uiFormat(Network, Cold, NULL, "Traveling...");
 	uiDraw();
 
-	sandboxEarly(log);
+	sandboxEarly(log, save);
 	int irc = ircConnect(bind, host, port);
 	sandboxLate(irc);
 
@@ -445,7 +516,7 @@ int main(int argc, char *argv[]) {
 	ircFormat("USER %s 0 * :%s\r\n", user, real);
 
 	// Avoid disabling VINTR until main loop.
-	inputInit();
+	if (!self.headless) inputInit();
 	signal(SIGHUP, signalHandler);
 	signal(SIGINT, signalHandler);
 	signal(SIGALRM, signalHandler);
@@ -464,19 +535,39 @@ int main(int argc, char *argv[]) {
 
 	bool ping = false;
 	struct pollfd fds[] = {
-		{ .events = POLLIN, .fd = STDIN_FILENO },
+		{ .events = POLLIN, .fd = (self.headless ? fifo : STDIN_FILENO) },
 		{ .events = POLLIN, .fd = irc },
+		{ .events = POLLIN, .fd = -1 },
+		{ .events = POLLIN, .fd = -1 },
 		{ .events = POLLIN, .fd = utilPipe[0] },
 		{ .events = POLLIN, .fd = execPipe[0] },
 	};
 	while (!self.quit) {
-		int nfds = poll(fds, (self.restricted ? 2 : ARRAY_LEN(fds)), -1);
+		int timeout = uiTimeout();
+		int timeouts[] = { journalTimeout(), notifyTimeout(), logTimeout() };
+		for (size_t i = 0; i < ARRAY_LEN(timeouts); ++i) {
+			if (timeouts[i] < 0) continue;
+			if (timeout < 0 || timeouts[i] < timeout) timeout = timeouts[i];
+		}
+		fds[2].fd = logGrepFd();
+		fds[3].fd = logInflateFd();
+		int nfds = poll(
+			fds, (self.restricted ? 4 : ARRAY_LEN(fds)), timeout
+		);
 		if (nfds < 0 && errno != EINTR) err(1, "poll");
 		if (nfds > 0) {
-			if (fds[0].revents) inputRead();
+			if (fds[0].revents) {
+				if (self.headless) {
+					fifoRead();
+				} else {
+					inputRead();
+				}
+			}
 			if (fds[1].revents) ircRecv();
-			if (fds[2].revents) utilRead();
-			if (fds[3].revents) execRead();
+			if (fds[2].revents) logGrepRead();
+			if (fds[3].revents) logInflateRead();
+			if (fds[4].revents) utilRead();
+			if (fds[5].revents) execRead();
 		}
 
 		if (signals[SIGHUP]) self.quit = "zzz";
@@ -517,6 +608,7 @@ int main(int argc, char *argv[]) {
 					);
 				}
 			}
+			notifyRestart();
 			uiShow();
 		}
 
@@ -528,7 +620,15 @@ int main(int argc, char *argv[]) {
 			inputRead();
 		}
 
-		uiDraw();
+		// Always draw keystrokes right away.
+		if (nfds > 0 && fds[0].revents) {
+			uiDraw();
+		} else {
+			uiFrame();
+		}
+		journalSync();
+		notifySync();
+		logSync();
 	}
 
 	if (self.quit) {
@@ -202,6 +202,7 @@ enum Cap {
 extern struct Self {
 	bool debug;
 	bool restricted;
+	bool headless;
 	size_t pos;
 	enum Cap caps;
 	const char *plainUser;
@@ -276,6 +277,9 @@ static inline void utilPush(struct Util *util, const char *arg) {
 	}
 }
 
+int utilSpawn(const struct Util *util, const int fds[3]);
+int utilSpawnQuiet(const struct Util *util, const int fds[3]);
+
 enum Reply {
 	ReplyAway = 1,
 	ReplyBan,
@@ -324,13 +328,17 @@ extern struct _win_st *uiStatus;
 extern struct _win_st *uiMain;
 extern struct _win_st *uiInput;
 extern bool uiSpoilerReveal;
-extern struct Util uiNotifyUtil;
+extern uint uiFrameRate;
+extern bool uiDirect;
 void uiInit(void);
+short uiColor(enum Color color);
 uint uiAttr(struct Style style);
 short uiPair(struct Style style);
 void uiShow(void);
 void uiHide(void);
 void uiDraw(void);
+void uiFrame(void);
+int uiTimeout(void);
 void uiResize(void);
 void uiWrite(uint id, enum Heat heat, const time_t *time, const char *str);
 void uiFormat(
@@ -338,6 +346,41 @@ void uiFormat(
 ) __attribute__((format(printf, 4, 5)));
 void uiLoad(const char *name);
 int uiSave(void);
+int uiCompact(void);
+
+void vtResize(int top, int rows, int cols);
+void vtInvalidate(void);
+void vtMove(int y, int x);
+void vtStyle(struct Style style);
+void vtPos(int *y, int *x);
+int vtAdd(const char *str, size_t len);
+void vtFill(wchar_t ch, int n);
+void vtClear(void);
+void vtScroll(int rows);
+void vtFlush(int y, int x);
+
+enum Entry {
+	EntryPush = 1,
+	EntryWindow,
+	EntryOrder,
+	EntryInput,
+	EntryPos,
+};
+void journalInit(int fd, off_t snapshot, off_t size);
+void journalClose(void);
+void journalMark(void);
+FILE *journalFile(void);
+int journalTimeout(void);
+int journalFlush(void);
+void journalSync(void);
+size_t journalReplay(const byte *data, size_t len);
+uint64_t journalChecksum(const byte *ptr, size_t len);
+
+extern struct Util notifyUtil;
+void notifyPush(uint id, const char *str);
+int notifyTimeout(void);
+void notifySync(void);
+void notifyRestart(void);
 
 extern enum InputMode {
 	InputEmacs,
@@ -351,6 +394,8 @@ void inputRead(void);
 void inputCompletion(void);
 int inputSave(FILE *file);
 void inputLoad(FILE *file, size_t version);
+void inputJournal(FILE *file);
+void inputReplay(const byte **ptr, const byte *end);
 
 enum Scroll {
 	ScrollOne,
@@ -367,6 +412,7 @@ extern struct Time {
 extern enum Heat windowThreshold;
 void windowInit(void);
 void windowUpdate(void);
+void windowDraw(void);
 void windowResize(void);
 bool windowWrite(uint id, enum Heat heat, const time_t *time, const char *str);
 void windowBare(void);
@@ -384,13 +430,22 @@ void windowUnmark(void);
 void windowToggleMute(void);
 void windowToggleTime(void);
 void windowToggleThresh(int n);
+size_t windowScrollback(uint id, size_t cap);
 bool windowTimeEnable(void);
 void windowScroll(enum Scroll by, int n);
 void windowSearch(const char *str, int dir);
+void windowFind(const char *pattern);
+void windowJump(size_t n);
+uint windowResults(const char *name);
+void windowSpill(uint id);
 int windowSave(FILE *file);
 void windowLoad(FILE *file, size_t version);
+size_t windowUnpack(const byte *data, size_t size);
+void windowJournal(FILE *file);
+void windowReplay(enum Entry entry, const byte **ptr, const byte *end);
 
 enum { BufferCap = 1024 };
+extern size_t bufferWrapCap;
 struct Buffer;
 struct Line {
 	uint num;
@@ -398,18 +453,38 @@ struct Line {
 	time_t time;
 	char *str;
 };
-struct Buffer *bufferAlloc(void);
+struct View {
+	const struct Line *line;
+	uint off;
+	uint len;
+	int align;
+	struct Style style;
+};
+struct Buffer *bufferAlloc(size_t cap);
 void bufferFree(struct Buffer *buffer);
+void bufferTrim(struct Buffer *buffer, size_t cap);
+size_t bufferSoftLen(const struct Buffer *buffer);
+size_t bufferHardLen(const struct Buffer *buffer);
 const struct Line *bufferSoft(const struct Buffer *buffer, size_t i);
-const struct Line *bufferHard(const struct Buffer *buffer, size_t i);
+const struct View *bufferHard(const struct Buffer *buffer, size_t i);
+const struct Line *bufferPeek(const struct Buffer *buffer, size_t i);
+void bufferCool(struct Buffer *buffer);
+size_t bufferFind(const struct Buffer *buffer, size_t i, const char *str);
 int bufferPush(
 	struct Buffer *buffer, int cols, enum Heat thresh,
 	enum Heat heat, time_t time, const char *str
 );
+void bufferLoad(
+	struct Buffer *buffer, enum Heat heat, time_t time, const char *str
+);
 int bufferReflow(
 	struct Buffer *buffer, int cols, enum Heat thresh, size_t tail
 );
 
+size_t lzBound(size_t len);
+size_t lzPack(byte *dst, size_t cap, const byte *src, size_t len);
+int lzUnpack(byte *dst, size_t cap, const byte *src, size_t len);
+
 struct Cursor {
 	uint gen;
 	struct Node *node;
@@ -449,10 +524,29 @@ struct Filter filterAdd(enum Heat heat, const char *pattern);
 bool filterRemove(struct Filter filter);
 enum Heat filterCheck(enum Heat heat, uint id, const struct Message *msg);
 
+extern uint logFlushDelay;
+extern struct Util logCompressUtil;
 void logOpen(void);
 void logFormat(uint id, const time_t *time, const char *format, ...)
 	__attribute__((format(printf, 3, 4)));
 void logClose(void);
+int logTimeout(void);
+void logSync(void);
+void logRelease(uint id);
+size_t logDepth(uint id, time_t before, size_t want);
+void logRead(
+	uint id, size_t back, size_t count,
+	struct Buffer *buffer, int cols, enum Heat thresh
+);
+extern const char logGrepName[];
+void logGrep(
+	uint id, const char *nick, const char *since, const char *until,
+	const char *pattern
+);
+int logGrepFd(void);
+void logGrepRead(void);
+int logInflateFd(void);
+void logInflateRead(void);
 
 char *configPath(char *buf, size_t cap, const char *path, int i);
 char *dataPath(char *buf, size_t cap, const char *path, int i);
@@ -524,6 +524,48 @@ static void commandCopy(uint id, char *params) {
 	urlCopyMatch(id, params);
 }
 
+static void commandScrollback(uint id, char *params) {
+	size_t cap = windowScrollback(id, (params ? strtoul(params, NULL, 10) : 0));
+	uiFormat(
+		id, Warm, NULL, "Scrollback of \3%02d%s\3 is %zu lines",
+		idColors[id], idNames[id], cap
+	);
+}
+
+static void commandSearch(uint id, char *params) {
+	(void)id;
+	if (params) windowFind(params);
+}
+
+static void commandGrep(uint id, char *params) {
+	bool all = false;
+	const char *nick = NULL, *since = NULL, *until = NULL;
+	while (params && params[0] == '-') {
+		char *flag = strsep(&params, " ");
+		const char **arg;
+		if (!strcmp(flag, "-a")) {
+			all = true;
+			continue;
+		} else if (!strcmp(flag, "-n")) {
+			arg = &nick;
+		} else if (!strcmp(flag, "-s")) {
+			arg = &since;
+		} else if (!strcmp(flag, "-u")) {
+			arg = &until;
+		} else {
+			uiFormat(id, Warm, NULL, "Unknown option %s", flag);
+			return;
+		}
+		*arg = strsep(&params, " ");
+	}
+	if (params) logGrep((all ? None : id), nick, since, until, params);
+}
+
+static void commandJump(uint id, char *params) {
+	(void)id;
+	if (params) windowJump(strtoul(params, NULL, 10));
+}
+
 static void commandFilter(enum Heat heat, uint id, char *params) {
 	if (params) {
 		struct Filter filter = filterAdd(heat, params);
@@ -572,20 +614,14 @@ static void commandUnignore(uint id, char *params) {
 
 static void commandExec(uint id, char *params) {
 	execID = id;
-
-	pid_t pid = fork();
-	if (pid < 0) err(1, "fork");
-	if (pid) return;
-
-	setsid();
-	close(STDIN_FILENO);
-	dup2(execPipe[1], STDOUT_FILENO);
-	dup2(utilPipe[1], STDERR_FILENO);
-
 	const char *shell = getenv("SHELL") ?: "/bin/sh";
-	execl(shell, shell, "-c", params, NULL);
-	warn("%s", shell);
-	_exit(127);
+	struct Util util = { 3, { shell, "-c", params } };
+	int error = utilSpawn(
+		&util, (int[]) { -1, execPipe[1], utilPipe[1] }
+	);
+	if (error) {
+		uiFormat(Network, Warm, NULL, "%s: %s", shell, strerror(error));
+	}
 }
 
 static void commandHelp(uint id, char *params) {
@@ -596,28 +632,39 @@ static void commandHelp(uint id, char *params) {
 		replies[ReplyHelp]++;
 		return;
 	}
-	if (self.restricted) {
+	if (self.restricted || self.headless) {
 		uiFormat(id, Warm, NULL, "See catgirl(1) or /help index");
 		return;
 	}
 
-	uiHide();
-	pid_t pid = fork();
-	if (pid < 0) err(1, "fork");
-	if (pid) return;
-
+	// Only the spawned man(1) should see the prompt added to LESS.
+	const char *less = getenv("LESS");
+	char *prev = (less ? strdup(less) : NULL);
+	if (less && !prev) err(1, "strdup");
 	char buf[256];
-	snprintf(buf, sizeof(buf), "%sp^COMMANDS$", (getenv("LESS") ?: ""));
+	snprintf(buf, sizeof(buf), "%sp^COMMANDS$", (less ?: ""));
 	setenv("LESS", buf, 1);
-	execlp("man", "man", "1", "catgirl", NULL);
-	dup2(utilPipe[1], STDERR_FILENO);
-	warn("man");
-	_exit(127);
+
+	uiHide();
+	struct Util util = { 3, { "man", "1", "catgirl" } };
+	int error = utilSpawn(&util, NULL);
+	if (error) {
+		uiShow();
+		uiFormat(id, Warm, NULL, "man: %s", strerror(error));
+	}
+
+	if (prev) {
+		setenv("LESS", prev, 1);
+	} else {
+		unsetenv("LESS");
+	}
+	free(prev);
 }
 
 enum Flag {
 	BIT(Multiline),
 	BIT(Restrict),
+	BIT(Interactive),
 };
 
 static const struct Handler {
@@ -628,7 +675,7 @@ static const struct Handler {
 } Commands[] = {
 	{ "/away", commandAway, 0, 0 },
 	{ "/ban", commandBan, 0, 0 },
-	{ "/close", commandClose, 0, 0 },
+	{ "/close", commandClose, Interactive, 0 },
 	{ "/copy", commandCopy, Restrict, 0 },
 	{ "/cs", commandCS, 0, 0 },
 	{ "/debug", commandDebug, 0, 0 },
@@ -638,17 +685,19 @@ static const struct Handler {
 	{ "/exec", commandExec, Multiline | Restrict, 0 },
 	{ "/fur", commandFur, 0, 0 },
 	{ "/furs", commandFurs, 0, 0 },
+	{ "/grep", commandGrep, Interactive, 0 },
 	{ "/help", commandHelp, 0, 0 }, // Restrict special case.
 	{ "/highlight", commandHighlight, 0, 0 },
 	{ "/ignore", commandIgnore, 0, 0 },
 	{ "/invex", commandInvex, 0, 0 },
 	{ "/invite", commandInvite, 0, 0 },
 	{ "/join", commandJoin, 0, 0 },
+	{ "/jump", commandJump, Interactive, 0 },
 	{ "/kick", commandKick, 0, 0 },
 	{ "/list", commandList, 0, 0 },
 	{ "/me", commandMe, Multiline, 0 },
 	{ "/mode", commandMode, 0, 0 },
-	{ "/move", commandMove, 0, 0 },
+	{ "/move", commandMove, Interactive, 0 },
 	{ "/msg", commandMsg, Multiline, 0 },
 	{ "/names", commandNames, 0, 0 },
 	{ "/nick", commandNick, 0, 0 },
@@ -664,6 +713,8 @@ static const struct Handler {
 	{ "/quit", commandQuit, 0, 0 },
 	{ "/quote", commandQuote, Multiline, 0 },
 	{ "/say", commandPrivmsg, Multiline, 0 },
+	{ "/scrollback", commandScrollback, 0, 0 },
+	{ "/search", commandSearch, Interactive, 0 },
 	{ "/setname", commandSetname, 0, CapSetname },
 	{ "/topic", commandTopic, 0, 0 },
 	{ "/trans", commandTrans, Multiline, 0 },
@@ -675,7 +726,7 @@ static const struct Handler {
 	{ "/voice", commandVoice, 0, 0 },
 	{ "/whois", commandWhois, 0, 0 },
 	{ "/whowas", commandWhowas, 0, 0 },
-	{ "/window", commandWindow, 0, 0 },
+	{ "/window", commandWindow, Interactive, 0 },
 };
 
 static int compar(const void *cmd, const void *_handler) {
@@ -733,6 +784,7 @@ size_t commandWillSplit(uint id, const char *input) {
 
 static bool commandAvailable(const struct Handler *handler) {
 	if (handler->flags & Restrict && self.restricted) return false;
+	if (handler->flags & Interactive && self.headless) return false;
 	if (handler->caps && (handler->caps & self.caps) != handler->caps) {
 		return false;
 	}
@@ -1427,6 +1427,7 @@ void handle(struct Message *msg) {
 	if (!msg->cmd) return;
 	if (msg->tags[TagPos]) {
 		self.pos = strtoull(msg->tags[TagPos], NULL, 10);
+		journalMark();
 	}
 	const struct Handler *handler = bsearch(
 		msg->cmd, Handlers, ARRAY_LEN(Handlers), sizeof(*handler), compar
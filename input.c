@@ -97,6 +97,9 @@ enum {
 static struct Edit cut;
 static struct Edit edits[IDCap];
 
+// Only inputs touched since the last batch are written to the journal.
+static bool dirty[IDCap];
+
 void inputInit(void) {
 	for (size_t i = 0; i < ARRAY_LEN(edits); ++i) {
 		edits[i].cut = &cut;
@@ -180,6 +183,7 @@ static size_t cap;
 static char *buf;
 
 void inputUpdate(void) {
+	if (self.headless) return;
 	uint id = windowID();
 
 	size_t pos = 0;
@@ -564,6 +568,8 @@ void inputRead(void) {
 		bool tabbing = false;
 		size_t pos = edits[tab.id].pos;
 		bool spr = uiSpoilerReveal;
+		dirty[windowID()] = true;
+		journalMark();
 
 		if (ret == KEY_CODE_YES && ch == KeyPasteOn) {
 			paste = true;
@@ -637,17 +643,49 @@ static ssize_t readString(FILE *file, char **buf, size_t *cap) {
 	return len;
 }
 
+static void inputSet(uint id, const char *str) {
+	size_t max = strlen(str);
+	editFn(&edits[id], EditClear);
+	int error = editReserve(&edits[id], 0, max);
+	if (error) err(1, "editReserve");
+	size_t len = mbstowcs(edits[id].buf, str, max);
+	assert(len != (size_t)-1);
+	edits[id].len = len;
+	edits[id].pos = len;
+}
+
 void inputLoad(FILE *file, size_t version) {
 	if (version < 8) return;
 	while (0 < readString(file, &buf, &cap) && buf[0]) {
 		uint id = idFor(buf);
 		readString(file, &buf, &cap);
-		size_t max = strlen(buf);
-		int error = editReserve(&edits[id], 0, max);
-		if (error) err(1, "editReserve");
-		size_t len = mbstowcs(edits[id].buf, buf, max);
-		assert(len != (size_t)-1);
-		edits[id].len = len;
-		edits[id].pos = len;
+		inputSet(id, buf);
+	}
+}
+
+void inputJournal(FILE *file) {
+	for (uint id = 0; id < IDCap; ++id) {
+		if (!dirty[id]) continue;
+		dirty[id] = false;
+		char *ptr = editString(&edits[id], &buf, &cap, NULL);
+		if (!ptr) err(1, "editString");
+		int error = 0
+			|| putc(EntryInput, file) == EOF
+			|| writeString(file, idNames[id])
+			|| writeString(file, ptr);
+		if (error) err(1, "journal");
 	}
 }
+
+static const char *readField(const byte **ptr, const byte *end) {
+	const byte *nul = memchr(*ptr, '\0', end - *ptr);
+	if (!nul) errx(1, "truncated save file");
+	const char *str = (const char *)*ptr;
+	*ptr = nul + 1;
+	return str;
+}
+
+void inputReplay(const byte **ptr, const byte *end) {
+	uint id = idFor(readField(ptr, end));
+	inputSet(id, readField(ptr, end));
+}
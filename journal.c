@@ -0,0 +1,191 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chat.h"
+
+// Changes since the last snapshot are appended to the save file in
+// batches, each a header of length and checksum followed by entries. A
+// batch is written and synced at most every few seconds, and the whole
+// file is compacted into a new snapshot once the journal outgrows it.
+// Each batch also carries the consumer position if it has moved, so that
+// the lines it restores aren't played back again by the bouncer.
+
+enum {
+	JournalDelay = 5,
+	JournalCompact = 1024 * 1024,
+};
+
+static int fd = -1;
+static off_t snapshot;
+static off_t size;
+static time_t pending;
+static uint64_t pos;
+
+static char *batchBuf;
+static size_t batchLen;
+static FILE *batch;
+
+// FNV-1a, shared with the snapshot header.
+uint64_t journalChecksum(const byte *ptr, size_t len) {
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ ptr[i]) * 0x100000001B3;
+	}
+	return hash;
+}
+
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+void journalInit(int file, off_t base, off_t used) {
+	fd = file;
+	snapshot = base;
+	size = used;
+	pos = self.pos;
+	if (batch) return;
+	batch = open_memstream(&batchBuf, &batchLen);
+	if (!batch) err(1, "open_memstream");
+}
+
+void journalClose(void) {
+	fd = -1;
+}
+
+void journalMark(void) {
+	if (fd < 0 || pending) return;
+	pending = now();
+}
+
+FILE *journalFile(void) {
+	if (fd < 0) return NULL;
+	journalMark();
+	return batch;
+}
+
+int journalTimeout(void) {
+	if (fd < 0 || !pending) return -1;
+	time_t left = pending + JournalDelay - now();
+	return (left > 0 ? left * 1000 : 0);
+}
+
+static int writeAll(const void *ptr, size_t len) {
+	for (const char *p = ptr; len;) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int journalFlush(void) {
+	if (fd < 0) return 0;
+	pending = 0;
+	windowJournal(batch);
+	inputJournal(batch);
+	if (self.pos != pos) {
+		pos = self.pos;
+		int error = 0
+			|| putc(EntryPos, batch) == EOF
+			|| !fwrite(&pos, sizeof(pos), 1, batch);
+		if (error) return -1;
+	}
+	if (fflush(batch)) return -1;
+	if (!batchLen) return 0;
+
+	uint64_t head[2] = {
+		batchLen, journalChecksum((byte *)batchBuf, batchLen),
+	};
+	int error = 0
+		|| writeAll(head, sizeof(head))
+		|| writeAll(batchBuf, batchLen)
+		|| fsync(fd);
+	if (error) return error;
+	size += sizeof(head) + batchLen;
+	fclose(batch);
+	free(batchBuf);
+	batch = open_memstream(&batchBuf, &batchLen);
+	if (!batch) return -1;
+
+	if (size < JournalCompact || size < snapshot) return 0;
+	return uiCompact();
+}
+
+void journalSync(void) {
+	if (journalTimeout()) return;
+	if (!journalFlush()) return;
+	// The save file is left as it was and rewritten in full at exit.
+	int error = errno;
+	journalClose();
+	uiFormat(
+		Network, Warm, NULL, "Journal stopped: %s", strerror(error)
+	);
+}
+
+static void replay(const byte *ptr, const byte *end) {
+	while (ptr < end) {
+		enum Entry entry = *ptr++;
+		if (entry == EntryInput) {
+			inputReplay(&ptr, end);
+		} else if (entry == EntryPos) {
+			if ((size_t)(end - ptr) < sizeof(pos)) {
+				errx(1, "truncated save file");
+			}
+			memcpy(&pos, ptr, sizeof(pos));
+			ptr += sizeof(pos);
+			self.pos = pos;
+		} else {
+			windowReplay(entry, &ptr, end);
+		}
+	}
+}
+
+size_t journalReplay(const byte *data, size_t len) {
+	const byte *ptr = data, *end = &data[len];
+	uint64_t head[2];
+	while ((size_t)(end - ptr) >= sizeof(head)) {
+		memcpy(head, ptr, sizeof(head));
+		if ((uint64_t)(end - ptr) - sizeof(head) < head[0]) break;
+		const byte *entries = &ptr[sizeof(head)];
+		if (journalChecksum(entries, head[0]) != head[1]) break;
+		replay(entries, &entries[head[0]]);
+		ptr = &entries[head[0]];
+	}
+	return ptr - data;
+}
@@ -26,13 +26,19 @@
  */
 
 #include <assert.h>
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -45,6 +51,115 @@
 
 static int logDir = -1;
 
+// Lines are formatted into a buffer for each file, which is handed to a
+// writer thread once it is old or large enough, so that the main thread
+// never waits on a slow log volume. Closing a file is queued after its
+// last buffer, and once a day's file is closed the main thread passes it
+// to the compression utility, if any.
+
+enum { LogFlushCap = 64 * 1024 };
+
+uint logFlushDelay = 1;
+struct Util logCompressUtil;
+
+struct Job {
+	struct Job *next;
+	int fd;
+	bool close;
+	char *compress;
+	size_t len;
+	char *buf;
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct Job *head;
+	struct Job **tail;
+	struct Job *closed;
+	bool done;
+	int error;
+} writer = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.tail = &writer.head,
+};
+
+static int writeAll(int fd, const char *ptr, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, ptr, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		ptr += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void *writerMain(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&writer.mutex);
+	for (;;) {
+		while (!writer.head && !writer.done) {
+			pthread_cond_wait(&writer.cond, &writer.mutex);
+		}
+		struct Job *job = writer.head;
+		if (!job) break;
+		writer.head = job->next;
+		if (!writer.head) writer.tail = &writer.head;
+		pthread_mutex_unlock(&writer.mutex);
+
+		int error = writeAll(job->fd, job->buf, job->len);
+		if (job->close) error |= close(job->fd);
+		int errnum = errno;
+		free(job->buf);
+		job->buf = NULL;
+
+		pthread_mutex_lock(&writer.mutex);
+		if (error && !writer.error) writer.error = errnum;
+		if (job->compress && !error) {
+			job->next = writer.closed;
+			writer.closed = job;
+		} else {
+			free(job->compress);
+			free(job);
+		}
+	}
+	pthread_mutex_unlock(&writer.mutex);
+	return NULL;
+}
+
+static void writerStart(void) {
+	// Leave signals to the main thread, so that they interrupt poll(2).
+	sigset_t mask, prev;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &prev);
+	int error = pthread_create(&writer.thread, NULL, writerMain, NULL);
+	if (error) {
+		errno = error;
+		err(1, "pthread_create");
+	}
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+}
+
+static void writerPush(struct Job *job) {
+	pthread_mutex_lock(&writer.mutex);
+	*writer.tail = job;
+	writer.tail = &job->next;
+	pthread_cond_signal(&writer.cond);
+	pthread_mutex_unlock(&writer.mutex);
+}
+
+static int writerStop(void) {
+	pthread_mutex_lock(&writer.mutex);
+	writer.done = true;
+	pthread_cond_signal(&writer.cond);
+	pthread_mutex_unlock(&writer.mutex);
+	pthread_join(writer.thread, NULL);
+	return writer.error;
+}
+
 void logOpen(void) {
 	char buf[PATH_MAX];
 	int error = mkdir(dataPath(buf, sizeof(buf), "", 0), S_IRWXU);
@@ -59,12 +174,15 @@ void logOpen(void) {
 #ifdef __FreeBSD__
 	cap_rights_t rights;
 	cap_rights_init(
-		&rights, CAP_MKDIRAT, CAP_CREATE, CAP_WRITE,
+		&rights, CAP_MKDIRAT, CAP_CREATE, CAP_WRITE, CAP_MMAP_R,
 		/* for fdopen(3) */ CAP_FCNTL, CAP_FSTAT
 	);
 	error = caph_rights_limit(logDir, &rights);
 	if (error) err(1, "cap_rights_limit");
 #endif
+
+	writerStart();
+	atexit(logClose);
 }
 
 static void logMkdir(const char *path) {
@@ -81,44 +199,204 @@ static void sanitize(char *ptr, char *end) {
 	}
 }
 
+// Timestamps are formatted from a cached span around the last one, in
+// which the date and UTC offset stay the same. Only a time outside of it
+// consults localtime(3), and only a day with an offset change searches
+// for where that happens.
+
 static struct {
-	int year;
-	int month;
-	int day;
-	FILE *file;
-} logs[IDCap];
+	time_t start;
+	time_t end;
+	time_t midnight;
+	long offset;
+	int key;
+	char date[sizeof("0000-00-00")];
+	char zone[sizeof("+0000")];
+} today;
 
-static FILE *logFile(uint id, const struct tm *tm) {
-	if (
-		logs[id].file &&
-		logs[id].year == tm->tm_year &&
-		logs[id].month == tm->tm_mon &&
-		logs[id].day == tm->tm_mday
-	) return logs[id].file;
+static long offsetAt(time_t time) {
+	struct tm tm;
+	if (!localtime_r(&time, &tm)) err(1, "localtime");
+	return tm.tm_gmtoff;
+}
 
-	if (logs[id].file) {
-		int error = fclose(logs[id].file);
-		if (error) err(1, "%s", idNames[id]);
+// Returns the time nearest to out that still has the offset of in.
+static time_t offsetEdge(time_t in, time_t out, long offset) {
+	while (in - out > 1 || out - in > 1) {
+		time_t mid = in + (out - in) / 2;
+		if (offsetAt(mid) == offset) {
+			in = mid;
+		} else {
+			out = mid;
+		}
 	}
+	return in;
+}
 
-	logs[id].year = tm->tm_year;
-	logs[id].month = tm->tm_mon;
-	logs[id].day = tm->tm_mday;
+static void todayUpdate(time_t time) {
+	if (time >= today.start && time < today.end) return;
 
-	char path[PATH_MAX];
-	char *ptr = path, *end = &path[sizeof(path)];
+	struct tm tm;
+	if (!localtime_r(&time, &tm)) err(1, "localtime");
+	today.offset = tm.tm_gmtoff;
+	today.midnight = time - (tm.tm_hour * 60 * 60 + tm.tm_min * 60 + tm.tm_sec);
+	today.start = today.midnight;
+	today.end = today.midnight + 24 * 60 * 60;
+	if (offsetAt(today.start) != today.offset) {
+		today.start = offsetEdge(time, today.start, today.offset);
+	}
+	if (offsetAt(today.end - 1) != today.offset) {
+		today.end = offsetEdge(time, today.end - 1, today.offset) + 1;
+	}
+
+	today.key = (tm.tm_year * 100 + tm.tm_mon) * 100 + tm.tm_mday;
+	strftime(today.date, sizeof(today.date), "%F", &tm);
+	strftime(today.zone, sizeof(today.zone), "%z", &tm);
+}
+
+enum { StampCap = sizeof("0000-00-00T00:00:00+0000") };
+
+static void stamp(char buf[static StampCap], time_t time) {
+	todayUpdate(time);
+	long secs = time - today.midnight;
+	int fields[] = { secs / (60 * 60), secs / 60 % 60, secs % 60 };
+	char *ptr = buf;
+	memcpy(ptr, today.date, sizeof(today.date) - 1);
+	ptr += sizeof(today.date) - 1;
+	for (int i = 0; i < 3; ++i) {
+		*ptr++ = (i ? ':' : 'T');
+		*ptr++ = '0' + fields[i] / 10;
+		*ptr++ = '0' + fields[i] % 10;
+	}
+	memcpy(ptr, today.zone, sizeof(today.zone));
+}
+
+static struct {
+	int key;
+	int newest;
+	char date[sizeof("0000-00-00")];
+	char compressed[sizeof("0000-00-00")];
+	bool open;
+	int fd;
+	char *buf;
+	size_t len;
+	size_t cap;
+} logs[IDCap];
+
+static time_t pending;
+
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void logFlush(uint id, bool close, const char *compress) {
+	if (!logs[id].len && !close) return;
+	struct Job *job = malloc(sizeof(*job));
+	if (!job) err(1, "malloc");
+	*job = (struct Job) {
+		.fd = logs[id].fd,
+		.close = close,
+		.len = logs[id].len,
+		.buf = logs[id].buf,
+	};
+	if (compress) {
+		job->compress = strdup(compress);
+		if (!job->compress) err(1, "strdup");
+	}
+	logs[id].buf = NULL;
+	logs[id].len = 0;
+	logs[id].cap = 0;
+	if (close) logs[id].open = false;
+	writerPush(job);
+}
 
+static char *dirPath(char *ptr, char *end, uint id) {
+	char *path = ptr;
 	ptr = seprintf(ptr, end, "%s", network.name);
 	sanitize(path, ptr);
-	logMkdir(path);
-
 	char *name = ptr;
 	ptr = seprintf(ptr, end, "/%s", idNames[id]);
 	sanitize(&name[1], ptr);
-	logMkdir(path);
+	return ptr;
+}
+
+// Utilities are given paths outside of logDir.
+static void fullPath(char *buf, size_t cap, const char *path) {
+	dataPath(buf, cap, "log", 0);
+	char *ptr = &buf[strlen(buf)];
+	seprintf(ptr, &buf[cap], "/%s", path);
+}
+
+enum {
+	DayCap = sizeof("0000-00-00.log"),
+	NameCap = DayCap + 16,
+};
+
+static char *dayPath(char *ptr, char *end, uint id, const char *date) {
+	ptr = dirPath(ptr, end, id);
+	return seprintf(ptr, end, "/%s.log", date);
+}
 
-	size_t len = strftime(ptr, end - ptr, "/%F.log", tm);
-	if (!len) errx(1, "log path too long");
+// Each time a window moves forward to a new day, the oldest plain day
+// before the one it leaves is compressed. Playback can still go back to
+// the day left, but not usually further.
+static int logOldest(uint id, const char *before) {
+	char path[PATH_MAX];
+	dirPath(path, &path[sizeof(path)], id);
+	int fd = openat(logDir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	DIR *dir = fdopendir(fd);
+	if (!dir) err(1, "log/%s", path);
+
+	// Days already passed to the utility may not be gone yet.
+	size_t len = DayCap - 5;
+	char oldest[DayCap] = "";
+	for (struct dirent *ent; NULL != (ent = readdir(dir));) {
+		const char *name = ent->d_name;
+		if (strlen(name) != DayCap - 1) continue;
+		if (strcmp(&name[DayCap - 5], ".log")) continue;
+		if (strncmp(name, before, len) >= 0) continue;
+		if (strncmp(name, logs[id].compressed, len) <= 0) continue;
+		if (!oldest[0] || strcmp(name, oldest) < 0) strcpy(oldest, name);
+	}
+	closedir(dir);
+	if (!oldest[0]) return -1;
+	memcpy(logs[id].compressed, oldest, len);
+	return 0;
+}
+
+static void logFile(uint id) {
+	if (logs[id].open && logs[id].key == today.key) return;
+
+	if (logs[id].open) {
+		char path[PATH_MAX];
+		bool compress = logCompressUtil.argc && !self.restricted
+			&& logs[id].key == logs[id].newest
+			&& logs[id].key < today.key
+			&& !logOldest(id, logs[id].date);
+		if (compress) {
+			dayPath(path, &path[sizeof(path)], id, logs[id].compressed);
+		}
+		logFlush(id, true, (compress ? path : NULL));
+	}
+	logs[id].key = today.key;
+	if (today.key > logs[id].newest) logs[id].newest = today.key;
+	memcpy(logs[id].date, today.date, sizeof(today.date));
+
+	char path[PATH_MAX], *end = &path[sizeof(path)];
+	if (dayPath(path, end, id, today.date) == end) {
+		errx(1, "log path too long");
+	}
+	char *slash = strrchr(path, '/');
+	*slash = '\0';
+	char *sep = strchr(path, '/');
+	*sep = '\0';
+	logMkdir(path);
+	*sep = '/';
+	logMkdir(path);
+	*slash = '/';
 
 	int fd = openat(
 		logDir, path,
@@ -126,43 +404,890 @@ static FILE *logFile(uint id, const struct tm *tm) {
 		S_IRUSR | S_IWUSR
 	);
 	if (fd < 0) err(1, "log/%s", path);
-	logs[id].file = fdopen(fd, "a");
-	if (!logs[id].file) err(1, "fdopen");
+	logs[id].open = true;
+	logs[id].fd = fd;
+}
+
+// Older history is paged back in from the day logs of a window, counting
+// back from the lines before a given time. Days are found newest first,
+// and each is mapped until released, with an index of the lines of the day
+// being read. A compressed day is instead read through its utility in the
+// background, and the window is told to page back again once it's whole.
+
+struct Day {
+	char name[NameCap];
+	bool ready;
+	bool heap;
+	const char *map;
+	size_t size;
+	bool counted;
+	size_t lines;
+};
+
+static struct {
+	time_t before;
+	size_t depth;
+	bool done;
+	size_t len, cap;
+	struct Day *days;
+	size_t mapped;
+	size_t *index;
+	size_t lines;
+} spills[IDCap];
+
+// Only one day is decompressed at a time, read a chunk whenever the main
+// loop finds its pipe readable. A day released meanwhile is still read to
+// the end, so as not to kill its utility, then thrown away.
+static struct {
+	int fd;
+	uint id;
+	size_t day;
+	bool dropped;
+	bool wait;
+	uint waitID;
+	char *buf;
+	size_t len, cap;
+} inflate = { .fd = -1 };
+
+void logRelease(uint id) {
+	if (inflate.fd >= 0 && inflate.id == id) inflate.dropped = true;
+	for (size_t i = 0; i < spills[id].len; ++i) {
+		struct Day *day = &spills[id].days[i];
+		if (day->heap) {
+			free((void *)day->map);
+		} else if (day->map) {
+			munmap((void *)day->map, day->size);
+		}
+	}
+	free(spills[id].days);
+	free(spills[id].index);
+	memset(&spills[id], 0, sizeof(spills[id]));
+}
+
+static int spillFind(uint id, char *name, const char *limit, bool incl) {
+	char path[PATH_MAX];
+	dirPath(path, &path[sizeof(path)], id);
+	int fd = openat(logDir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	DIR *dir = fdopendir(fd);
+	if (!dir) err(1, "log/%s", path);
+
+	// Days are compared without any compression suffix, and a day found
+	// both ways is read from its plain file.
+	bool compress = logCompressUtil.argc && !self.restricted;
+	name[0] = '\0';
+	for (struct dirent *ent; NULL != (ent = readdir(dir));) {
+		size_t len = strlen(ent->d_name);
+		if (len < DayCap - 1 || len >= NameCap) continue;
+		if (strncmp(&ent->d_name[DayCap - 5], ".log", 4)) continue;
+		if (len > DayCap - 1) {
+			if (!compress || ent->d_name[DayCap - 1] != '.') continue;
+		}
+		int cmp = strncmp(ent->d_name, limit, DayCap - 1);
+		if (cmp > 0 || (!cmp && !incl)) continue;
+		cmp = strncmp(ent->d_name, name, DayCap - 1);
+		if (cmp > 0 || (!cmp && len == DayCap - 1)) {
+			strcpy(name, ent->d_name);
+		}
+	}
+	closedir(dir);
+	return (name[0] ? 0 : -1);
+}
+
+static void inflateStart(uint id, size_t i, const char *path) {
+	int rw[2];
+	int error = pipe(rw);
+	if (error) err(1, "pipe");
+	fcntl(rw[0], F_SETFD, FD_CLOEXEC);
+	fcntl(rw[1], F_SETFD, FD_CLOEXEC);
 
-	setlinebuf(logs[id].file);
-	return logs[id].file;
+	char buf[PATH_MAX];
+	fullPath(buf, sizeof(buf), path);
+	struct Util util = logCompressUtil;
+	utilPush(&util, "-dc");
+	utilPush(&util, buf);
+	error = utilSpawn(&util, (int[]) { -1, rw[1], utilPipe[1] });
+	close(rw[1]);
+	if (error) {
+		uiFormat(
+			Network, Warm, NULL, "%s: %s",
+			util.argv[0], strerror(error)
+		);
+		close(rw[0]);
+		spills[id].days[i].ready = true;
+		return;
+	}
+
+	inflate.fd = rw[0];
+	inflate.id = id;
+	inflate.day = i;
+	inflate.dropped = false;
+	inflate.len = 0;
+	inflate.cap = 64 * 1024;
+	inflate.buf = malloc(inflate.cap);
+	if (!inflate.buf) err(1, "malloc");
+}
+
+int logInflateFd(void) {
+	return inflate.fd;
+}
+
+void logInflateRead(void) {
+	if (inflate.len == inflate.cap) {
+		inflate.buf = realloc(inflate.buf, inflate.cap *= 2);
+		if (!inflate.buf) err(1, "realloc");
+	}
+	ssize_t n = read(
+		inflate.fd, &inflate.buf[inflate.len], inflate.cap - inflate.len
+	);
+	if (n < 0 && errno == EINTR) return;
+	if (n < 0) err(1, "read");
+	inflate.len += n;
+	if (n) return;
+
+	close(inflate.fd);
+	inflate.fd = -1;
+	uint id = inflate.id;
+	if (inflate.dropped) {
+		free(inflate.buf);
+	} else {
+		struct Day *day = &spills[id].days[inflate.day];
+		day->ready = true;
+		day->heap = true;
+		day->map = inflate.buf;
+		day->size = inflate.len;
+	}
+	inflate.buf = NULL;
+
+	bool wait = inflate.wait;
+	uint waitID = inflate.waitID;
+	inflate.wait = false;
+	windowSpill(id);
+	if (wait && waitID != id) windowSpill(waitID);
+}
+
+static void spillOpen(uint id, size_t i) {
+	struct Day *day = &spills[id].days[i];
+	char path[PATH_MAX], *end = &path[sizeof(path)];
+	char *ptr = dirPath(path, end, id);
+	seprintf(ptr, end, "/%s", day->name);
+
+	int fd = -1;
+	if (!day->name[DayCap - 1]) {
+		fd = openat(logDir, path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 && errno != ENOENT) err(1, "log/%s", path);
+	}
+	if (fd < 0 && !day->name[DayCap - 1]) {
+		// The day may have been compressed since it was found.
+		char name[NameCap];
+		if (
+			spillFind(id, name, day->name, true) < 0 ||
+			strncmp(name, day->name, DayCap - 1) || !name[DayCap - 1]
+		) {
+			errno = ENOENT;
+			err(1, "log/%s", path);
+		}
+		strcpy(day->name, name);
+		seprintf(ptr, end, "/%s", day->name);
+	}
+
+	if (fd >= 0) {
+		struct stat st;
+		int error = fstat(fd, &st);
+		if (error) err(1, "log/%s", path);
+		if (st.st_size) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED) err(1, "log/%s", path);
+			day->map = map;
+			day->size = st.st_size;
+		}
+		close(fd);
+		day->ready = true;
+	} else if (inflate.fd < 0) {
+		inflateStart(id, i, path);
+	} else if (inflate.id != id || inflate.day != i || inflate.dropped) {
+		inflate.wait = true;
+		inflate.waitID = id;
+	}
+}
+
+static void spillMap(uint id, size_t i) {
+	if (spills[id].index && spills[id].mapped == i) return;
+	free(spills[id].index);
+	spills[id].mapped = i;
+
+	// The index holds the offset of each complete line, plus one past the
+	// end of the last.
+	const struct Day *day = &spills[id].days[i];
+	size_t cap = 64;
+	size_t *index = malloc(sizeof(*index) * cap);
+	if (!index) err(1, "malloc");
+	size_t lines = 0;
+	index[0] = 0;
+	for (size_t off = 0; off < day->size;) {
+		const char *nl = memchr(&day->map[off], '\n', day->size - off);
+		if (!nl) break;
+		off = nl - day->map + 1;
+		if (lines + 2 > cap) {
+			cap *= 2;
+			index = realloc(index, sizeof(*index) * cap);
+			if (!index) err(1, "realloc");
+		}
+		index[++lines] = off;
+	}
+	spills[id].index = index;
+	spills[id].lines = lines;
+}
+
+static const char *lineTime(const char *line, time_t *time) {
+	struct tm tm = {0};
+	const char *str = strptime(line, "[%Y-%m-%dT%H:%M:%S%z]", &tm);
+	if (!str) {
+		*time = 0;
+		return line;
+	}
+	*time = timegm(&tm) - tm.tm_gmtoff;
+	if (*str == ' ') str++;
+	return str;
 }
 
+static const char *spillLine(uint id, size_t i, time_t *time) {
+	static char buf[1024];
+	const char *map = spills[id].days[spills[id].mapped].map;
+	const size_t *index = spills[id].index;
+	size_t len = index[i + 1] - index[i] - 1;
+	if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+	memcpy(buf, &map[index[i]], len);
+	buf[len] = '\0';
+	return lineTime(buf, time);
+}
+
+// Stops short while a compressed day is being read.
+size_t logDepth(uint id, time_t before, size_t want) {
+	if (logDir < 0) return 0;
+	if (spills[id].before != before) {
+		logRelease(id);
+		spills[id].before = before;
+	}
+	while (!spills[id].done && spills[id].depth < want) {
+		size_t len = spills[id].len;
+		if (!len || spills[id].days[len - 1].counted) {
+			char limit[NameCap];
+			bool incl = !len;
+			if (incl) {
+				strftime(limit, sizeof(limit), "%F.log", localtime(&before));
+			} else {
+				strcpy(limit, spills[id].days[len - 1].name);
+			}
+
+			struct Day day = {0};
+			if (spillFind(id, day.name, limit, incl) < 0) {
+				spills[id].done = true;
+				break;
+			}
+			if (len == spills[id].cap) {
+				spills[id].cap = (spills[id].cap ? spills[id].cap * 2 : 8);
+				spills[id].days = realloc(
+					spills[id].days,
+					sizeof(*spills[id].days) * spills[id].cap
+				);
+				if (!spills[id].days) err(1, "realloc");
+			}
+			spills[id].days[len++] = day;
+			spills[id].len = len;
+		}
+
+		struct Day *day = &spills[id].days[len - 1];
+		if (!day->ready) spillOpen(id, len - 1);
+		if (!day->ready) break;
+		spillMap(id, len - 1);
+		size_t lines = spills[id].lines;
+		while (lines) {
+			time_t time;
+			spillLine(id, lines - 1, &time);
+			if (time < before) break;
+			lines--;
+		}
+		day->counted = true;
+		day->lines = lines;
+		spills[id].depth += lines;
+	}
+	return (spills[id].depth < want ? spills[id].depth : want);
+}
+
+void logRead(
+	uint id, size_t back, size_t count,
+	struct Buffer *buffer, int cols, enum Heat thresh
+) {
+	assert(count <= back && back <= spills[id].depth);
+	size_t day = 0;
+	while (back > spills[id].days[day].lines) {
+		back -= spills[id].days[day++].lines;
+	}
+	size_t i = spills[id].days[day].lines - back;
+	while (count--) {
+		while (i == spills[id].days[day].lines) {
+			day--;
+			i = 0;
+		}
+		spillMap(id, day);
+		time_t time;
+		const char *str = spillLine(id, i++, &time);
+		bufferPush(buffer, cols, thresh, Cold, time, str);
+	}
+}
+
+int logTimeout(void) {
+	if (!pending) return -1;
+	time_t left = pending + logFlushDelay - now();
+	return (left > 0 ? left * 1000 : 0);
+}
+
+static void logCompress(struct Job *closed) {
+	while (closed) {
+		struct Job *job = closed;
+		closed = job->next;
+
+		char path[PATH_MAX];
+		fullPath(path, sizeof(path), job->compress);
+		struct Util util = logCompressUtil;
+		utilPush(&util, path);
+		int error = utilSpawn(&util, (int[]) { -1, utilPipe[1], utilPipe[1] });
+		if (error) {
+			uiFormat(
+				Network, Warm, NULL, "%s: %s",
+				util.argv[0], strerror(error)
+			);
+		}
+		free(job->compress);
+		free(job);
+	}
+}
+
+void logSync(void) {
+	if (logDir < 0) return;
+	pthread_mutex_lock(&writer.mutex);
+	int error = writer.error;
+	struct Job *closed = writer.closed;
+	writer.closed = NULL;
+	pthread_mutex_unlock(&writer.mutex);
+	if (error) {
+		errno = error;
+		err(1, "log");
+	}
+	logCompress(closed);
+	if (logTimeout()) return;
+	for (uint id = 0; id < IDCap; ++id) {
+		logFlush(id, false, NULL);
+	}
+	pending = 0;
+}
+
+static void grepStop(void);
+
+// Also called at exit, so as not to lose buffered lines.
 void logClose(void) {
 	if (logDir < 0) return;
+	grepStop();
 	for (uint id = 0; id < IDCap; ++id) {
-		if (!logs[id].file) continue;
-		int error = fclose(logs[id].file);
-		if (error) err(1, "%s", idNames[id]);
+		logRelease(id);
+		if (logs[id].open) logFlush(id, true, NULL);
+	}
+	int error = writerStop();
+	if (error) {
+		errno = error;
+		warn("log");
+	}
+	logCompress(writer.closed);
+	writer.closed = NULL;
+	if (inflate.fd >= 0) {
+		close(inflate.fd);
+		inflate.fd = -1;
+		free(inflate.buf);
+		inflate.buf = NULL;
 	}
 	close(logDir);
+	logDir = -1;
 }
 
-void logFormat(uint id, const time_t *src, const char *format, ...) {
-	if (logDir < 0) return;
+static void logAppend(uint id, const char *format, va_list ap) {
+	for (;;) {
+		va_list copy;
+		va_copy(copy, ap);
+		size_t cap = logs[id].cap - logs[id].len;
+		int n = vsnprintf(
+			(cap ? &logs[id].buf[logs[id].len] : NULL), cap, format, copy
+		);
+		va_end(copy);
+		if (n < 0) err(1, "%s", idNames[id]);
+		if ((size_t)n < cap) {
+			logs[id].len += n;
+			return;
+		}
+		size_t need = logs[id].len + n + 1;
+		logs[id].cap = (logs[id].cap ? logs[id].cap : 1024);
+		while (logs[id].cap < need) logs[id].cap *= 2;
+		logs[id].buf = realloc(logs[id].buf, logs[id].cap);
+		if (!logs[id].buf) err(1, "realloc");
+	}
+}
 
-	time_t ts = (src ? *src : time(NULL));
-	struct tm *tm = localtime(&ts);
-	if (!tm) err(1, "localtime");
+static void logPrint(uint id, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	logAppend(id, format, ap);
+	va_end(ap);
+}
 
-	FILE *file = logFile(id, tm);
+void logFormat(uint id, const time_t *src, const char *format, ...) {
+	if (logDir < 0) return;
 
-	char buf[sizeof("0000-00-00T00:00:00+0000")];
-	strftime(buf, sizeof(buf), "%FT%T%z", tm);
-	int n = fprintf(file, "[%s] ", buf);
-	if (n < 0) err(1, "%s", idNames[id]);
+	char buf[StampCap];
+	stamp(buf, (src ? *src : time(NULL)));
+	logFile(id);
+	logPrint(id, "[%s] ", buf);
 
 	va_list ap;
 	va_start(ap, format);
-	n = vfprintf(file, format, ap);
+	logAppend(id, format, ap);
 	va_end(ap);
-	if (n < 0) err(1, "%s", idNames[id]);
 
-	n = fprintf(file, "\n");
-	if (n < 0) err(1, "%s", idNames[id]);
+	logPrint(id, "\n");
+
+	if (!logFlushDelay || logs[id].len >= LogFlushCap) {
+		logFlush(id, false, NULL);
+	} else if (!pending) {
+		pending = now();
+	}
+}
+
+// Logs are searched by a few threads, which take day files in turn from a
+// list made up front, newest first, and map each. Compressed days are read
+// through the compression utility instead. Matching lines are written to a
+// pipe as they are found, so that results stream into the main loop
+// instead of it waiting on the search.
+
+enum { GrepThreads = 4, GrepCap = 1000 };
+
+const char logGrepName[] = "<grep>";
+
+struct Search {
+	pthread_mutex_t mutex;
+	uint refs;
+	uint workers;
+	bool cancel;
+	int dir;
+	char *base;
+	int fd;
+	size_t failed;
+	size_t next, len, cap;
+	char **paths;
+	char *nick;
+	char *text;
+	bool re;
+	regex_t regex;
+};
+
+static struct {
+	struct Search *search;
+	uint id;
+	int fd;
+	char *pattern;
+	size_t results;
+	size_t skipped;
+	size_t len;
+	char buf[2 * PIPE_BUF];
+} grep = { .fd = -1 };
+
+static void searchFree(struct Search *search) {
+	for (size_t i = 0; i < search->len; ++i) {
+		free(search->paths[i]);
+	}
+	free(search->paths);
+	free(search->base);
+	free(search->nick);
+	free(search->text);
+	if (search->re) regfree(&search->regex);
+	if (search->dir >= 0) close(search->dir);
+	pthread_mutex_destroy(&search->mutex);
+	free(search);
+}
+
+static void searchRelease(struct Search *search) {
+	pthread_mutex_lock(&search->mutex);
+	bool last = !--search->refs;
+	pthread_mutex_unlock(&search->mutex);
+	if (last) searchFree(search);
+}
+
+// Lines are matched by the nick at the start of a message, action, notice
+// or event.
+static bool grepNick(const char *str, const char *nick) {
+	if (!strncmp(str, "* ", 2)) {
+		str += 2;
+	} else if (str[0] == '<' || str[0] == '-') {
+		str++;
+	}
+	size_t len = strlen(nick);
+	if (strncasecmp(str, nick, len)) return false;
+	return str[len] && strchr(">- ", str[len]);
+}
+
+static bool grepMatch(const struct Search *search, const char *line) {
+	const char *str = strstr(line, "] ");
+	str = (str ? &str[2] : line);
+	if (search->nick && !grepNick(str, search->nick)) return false;
+	if (search->re) return !regexec(&search->regex, str, 0, NULL, 0);
+	return strcasestr(str, search->text);
+}
+
+// Each result is the name of its window, a NUL and the line, short enough
+// to be written to the pipe whole.
+static int
+grepLine(struct Search *search, const char *path, const char *ptr, size_t len) {
+	char line[1024];
+	if (len >= sizeof(line)) len = sizeof(line) - 1;
+	memcpy(line, ptr, len);
+	line[len] = '\0';
+	if (!grepMatch(search, line)) return 0;
+
+	const char *name = &strchr(path, '/')[1];
+	int nameLen = strrchr(path, '/') - name;
+	char buf[PIPE_BUF];
+	int n = snprintf(
+		buf, sizeof(buf) - 1, "%.*s%c%s", nameLen, name, '\0', line
+	);
+	if (n < 0) return 0;
+	if ((size_t)n > sizeof(buf) - 2) n = sizeof(buf) - 2;
+	buf[n++] = '\n';
+	return writeAll(search->fd, buf, n);
+}
+
+static int grepFile(struct Search *search, const char *path) {
+	int fd = openat(search->dir, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0;
+	struct stat st;
+	int error = fstat(fd, &st);
+	if (error || !st.st_size) {
+		close(fd);
+		return 0;
+	}
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	size_t size = st.st_size;
+	for (size_t off = 0; !error && off < size;) {
+		const char *nl = memchr(&map[off], '\n', size - off);
+		if (!nl) break;
+		error = grepLine(search, path, &map[off], nl - &map[off]);
+		off = nl - map + 1;
+	}
+	munmap((void *)map, size);
+	return error;
+}
+
+// The utility's output is read to the end even once the search is
+// cancelled, rather than killing it with SIGPIPE.
+static int grepInflate(struct Search *search, const char *path) {
+	int rw[2];
+	int error = pipe(rw);
+	if (error) err(1, "pipe");
+	fcntl(rw[0], F_SETFD, FD_CLOEXEC);
+	fcntl(rw[1], F_SETFD, FD_CLOEXEC);
+
+	char full[PATH_MAX];
+	snprintf(full, sizeof(full), "%s/%s", search->base, path);
+	struct Util util = logCompressUtil;
+	utilPush(&util, "-dc");
+	utilPush(&util, full);
+	error = utilSpawnQuiet(&util, (int[]) { -1, rw[1], utilPipe[1] });
+	close(rw[1]);
+	if (error) {
+		close(rw[0]);
+		pthread_mutex_lock(&search->mutex);
+		search->failed++;
+		pthread_mutex_unlock(&search->mutex);
+		return 0;
+	}
+
+	char buf[64 * 1024];
+	size_t len = 0;
+	bool skip = false;
+	for (;;) {
+		ssize_t n = read(rw[0], &buf[len], sizeof(buf) - len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		len += n;
+
+		char *ptr = buf;
+		for (
+			char *nl;
+			NULL != (nl = memchr(ptr, '\n', &buf[len] - ptr));
+			ptr = &nl[1]
+		) {
+			if (!error && !skip) {
+				error = grepLine(search, path, ptr, nl - ptr);
+			}
+			skip = false;
+		}
+		// Only the start of a line longer than the buffer is matched.
+		if (ptr == buf && len == sizeof(buf)) {
+			if (!error && !skip) error = grepLine(search, path, buf, len);
+			skip = true;
+			ptr = &buf[len];
+		}
+		len -= ptr - buf;
+		memmove(buf, ptr, len);
+	}
+	close(rw[0]);
+	return error;
+}
+
+static void *grepMain(void *arg) {
+	struct Search *search = arg;
+	for (int error = 0; !error;) {
+		const char *path = NULL;
+		pthread_mutex_lock(&search->mutex);
+		if (!search->cancel && search->next < search->len) {
+			path = search->paths[search->next++];
+		}
+		pthread_mutex_unlock(&search->mutex);
+		if (!path) break;
+		// Writing fails once the search is cancelled and the pipe closed.
+		if (strlen(strrchr(path, '/')) == DayCap) {
+			error = grepFile(search, path);
+		} else {
+			error = grepInflate(search, path);
+		}
+	}
+	pthread_mutex_lock(&search->mutex);
+	if (!--search->workers) close(search->fd);
+	pthread_mutex_unlock(&search->mutex);
+	searchRelease(search);
+	return NULL;
+}
+
+// A day found both ways is searched in its plain file, as when paging
+// back. Without the utility, compressed days are counted as skipped.
+static void grepList(
+	struct Search *search, const char *dir,
+	const char *since, const char *until
+) {
+	int fd = openat(logDir, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return;
+	DIR *list = fdopendir(fd);
+	if (!list) err(1, "log/%s", dir);
+	bool compress = logCompressUtil.argc && !self.restricted;
+	for (struct dirent *ent; NULL != (ent = readdir(list));) {
+		const char *name = ent->d_name;
+		size_t len = strlen(name);
+		if (len < DayCap - 1 || len >= NameCap) continue;
+		if (strncmp(&name[DayCap - 5], ".log", 4)) continue;
+		if (since && strncmp(name, since, strlen(since)) < 0) continue;
+		if (until && strncmp(name, until, strlen(until)) > 0) continue;
+		if (name[DayCap - 1]) {
+			if (name[DayCap - 1] != '.') continue;
+			char plain[DayCap];
+			memcpy(plain, name, DayCap - 1);
+			plain[DayCap - 1] = '\0';
+			struct stat st;
+			if (!fstatat(dirfd(list), plain, &st, 0)) continue;
+			if (!compress) {
+				grep.skipped++;
+				continue;
+			}
+		}
+		if (search->len == search->cap) {
+			search->cap = (search->cap ? search->cap * 2 : 64);
+			search->paths = realloc(
+				search->paths, sizeof(*search->paths) * search->cap
+			);
+			if (!search->paths) err(1, "realloc");
+		}
+		char *path = malloc(strlen(dir) + 1 + strlen(name) + 1);
+		if (!path) err(1, "malloc");
+		sprintf(path, "%s/%s", dir, name);
+		search->paths[search->len++] = path;
+	}
+	closedir(list);
+}
+
+static int newest(const void *_a, const void *_b) {
+	const char *const *a = _a;
+	const char *const *b = _b;
+	return strcmp(strrchr(*b, '/'), strrchr(*a, '/'));
+}
+
+static void grepStop(void) {
+	if (!grep.search) return;
+	pthread_mutex_lock(&grep.search->mutex);
+	grep.search->cancel = true;
+	pthread_mutex_unlock(&grep.search->mutex);
+	close(grep.fd);
+	grep.fd = -1;
+	searchRelease(grep.search);
+	grep.search = NULL;
+}
+
+static void grepDone(const char *more) {
+	uiFormat(
+		grep.id, Cold, NULL, "%zu%s results for %s",
+		grep.results, more, grep.pattern
+	);
+	pthread_mutex_lock(&grep.search->mutex);
+	size_t skipped = grep.skipped + grep.search->failed;
+	pthread_mutex_unlock(&grep.search->mutex);
+	if (skipped) {
+		uiFormat(
+			grep.id, Cold, NULL, "%zu compressed days not searched",
+			skipped
+		);
+	}
+	grepStop();
+}
+
+// Searches the logs of a window, or of every window without one.
+void logGrep(
+	uint id, const char *nick, const char *since, const char *until,
+	const char *pattern
+) {
+	if (logDir < 0) {
+		uiFormat(Network, Warm, NULL, "Logging is not enabled");
+		return;
+	}
+	struct Search *search = calloc(1, sizeof(*search));
+	if (!search) err(1, "calloc");
+	pthread_mutex_init(&search->mutex, NULL);
+	search->dir = -1;
+
+	size_t len = strlen(pattern);
+	if (len > 2 && pattern[0] == '/' && pattern[len - 1] == '/') {
+		char *copy = strndup(&pattern[1], len - 2);
+		if (!copy) err(1, "strndup");
+		int error = regcomp(
+			&search->regex, copy, REG_EXTENDED | REG_ICASE | REG_NOSUB
+		);
+		free(copy);
+		if (error) {
+			char buf[256];
+			regerror(error, &search->regex, buf, sizeof(buf));
+			uiFormat(Network, Warm, NULL, "%s: %s", pattern, buf);
+			searchFree(search);
+			return;
+		}
+		search->re = true;
+	} else {
+		search->text = strdup(pattern);
+		if (!search->text) err(1, "strdup");
+	}
+	if (nick) {
+		search->nick = strdup(nick);
+		if (!search->nick) err(1, "strdup");
+	}
+
+	grepStop();
+	grep.skipped = 0;
+	char path[PATH_MAX], *end = &path[sizeof(path)];
+	if (id) {
+		dirPath(path, end, id);
+		grepList(search, path, since, until);
+	} else {
+		char *ptr = seprintf(path, end, "%s", network.name);
+		sanitize(path, ptr);
+		int fd = openat(logDir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		DIR *dir = (fd < 0 ? NULL : fdopendir(fd));
+		if (fd >= 0 && !dir) err(1, "log/%s", path);
+		for (struct dirent *ent; dir && NULL != (ent = readdir(dir));) {
+			if (ent->d_name[0] == '.') continue;
+			seprintf(ptr, end, "/%s", ent->d_name);
+			grepList(search, path, since, until);
+		}
+		if (dir) closedir(dir);
+	}
+	qsort(search->paths, search->len, sizeof(*search->paths), newest);
+
+	int rw[2];
+	int error = pipe(rw);
+	if (error) err(1, "pipe");
+	fcntl(rw[0], F_SETFD, FD_CLOEXEC);
+	fcntl(rw[1], F_SETFD, FD_CLOEXEC);
+	search->fd = rw[1];
+	search->dir = fcntl(logDir, F_DUPFD_CLOEXEC, 0);
+	if (search->dir < 0) err(1, "fcntl");
+	char base[PATH_MAX];
+	dataPath(base, sizeof(base), "log", 0);
+	search->base = strdup(base);
+	if (!search->base) err(1, "strdup");
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint threads = (cpus > 0 && cpus < GrepThreads ? cpus : GrepThreads);
+	if (threads > search->len) threads = search->len;
+	search->workers = threads;
+	search->refs = threads + 1;
+	if (!threads) close(search->fd);
+
+	// Leave signals to the main thread, and have writes to a closed pipe
+	// fail with EPIPE.
+	sigset_t mask, prev;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &prev);
+	for (uint i = 0; i < threads; ++i) {
+		pthread_t thread;
+		error = pthread_create(&thread, NULL, grepMain, search);
+		if (error) {
+			errno = error;
+			err(1, "pthread_create");
+		}
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	free(grep.pattern);
+	grep.pattern = strdup(pattern);
+	if (!grep.pattern) err(1, "strdup");
+	grep.search = search;
+	grep.fd = rw[0];
+	grep.results = 0;
+	grep.len = 0;
+	grep.id = windowResults(logGrepName);
+	uiFormat(
+		grep.id, Cold, NULL, "Searching %zu days for %s",
+		search->len, pattern
+	);
+	windowShow(windowFor(grep.id));
+}
+
+int logGrepFd(void) {
+	return grep.fd;
+}
+
+void logGrepRead(void) {
+	ssize_t n = read(grep.fd, &grep.buf[grep.len], sizeof(grep.buf) - grep.len);
+	if (n < 0 && errno == EINTR) return;
+	if (n < 0) err(1, "read");
+	grep.len += n;
+
+	char *ptr = grep.buf;
+	for (
+		char *nl;
+		NULL != (nl = memchr(ptr, '\n', &grep.buf[grep.len] - ptr));
+		ptr = &nl[1]
+	) {
+		*nl = '\0';
+		const char *name = ptr;
+		time_t time;
+		const char *str = lineTime(&name[strlen(name) + 1], &time);
+		uint id = idFind(name);
+		uiFormat(
+			grep.id, Cold, (time ? &time : NULL), "\3%02d%s\3\t%s",
+			(id ? idColors[id] : Default), name, str
+		);
+		if (++grep.results < GrepCap) continue;
+		grepDone(" or more");
+		return;
+	}
+	grep.len -= ptr - grep.buf;
+	memmove(grep.buf, ptr, grep.len);
+	if (!n) grepDone("");
 }
@@ -0,0 +1,195 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat.h"
+
+// A small LZ77 compressor in the style of LZ4. Each sequence is a token
+// holding the literal and match lengths, extra length bytes, the literals,
+// then a 16-bit match offset. The last sequence has only literals.
+
+enum {
+	HashBits = 12,
+	MinMatch = 4,
+	MaxOffset = 0xFFFF,
+};
+
+static uint32_t load32(const byte *ptr) {
+	uint32_t u;
+	memcpy(&u, ptr, sizeof(u));
+	return u;
+}
+
+static uint hashOf(uint32_t u) {
+	return (u * 2654435761u) >> (32 - HashBits);
+}
+
+size_t lzBound(size_t len) {
+	return len + len / 255 + 16;
+}
+
+static byte *putLen(byte *ptr, byte *end, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (ptr == end) return NULL;
+		*ptr++ = 255;
+	}
+	if (ptr == end) return NULL;
+	*ptr++ = len;
+	return ptr;
+}
+
+static byte *putSeq(
+	byte *ptr, byte *end, const byte *lit, size_t litLen,
+	size_t offset, size_t matchLen
+) {
+	if (ptr == end) return NULL;
+	byte *token = ptr++;
+	*token = (litLen < 15 ? litLen : 15) << 4;
+	if (litLen >= 15 && !(ptr = putLen(ptr, end, litLen - 15))) return NULL;
+	if ((size_t)(end - ptr) < litLen) return NULL;
+	memcpy(ptr, lit, litLen);
+	ptr += litLen;
+	if (!matchLen) return ptr;
+
+	if (end - ptr < 2) return NULL;
+	*ptr++ = offset & 0xFF;
+	*ptr++ = offset >> 8;
+	matchLen -= MinMatch;
+	*token |= (matchLen < 15 ? matchLen : 15);
+	if (matchLen >= 15) ptr = putLen(ptr, end, matchLen - 15);
+	return ptr;
+}
+
+size_t lzPack(byte *dst, size_t cap, const byte *src, size_t len) {
+	uint32_t table[1 << HashBits] = {0};
+	byte *ptr = dst, *end = &dst[cap];
+	size_t lit = 0;
+	for (size_t i = 0; i + MinMatch <= len;) {
+		uint32_t u = load32(&src[i]);
+		uint h = hashOf(u);
+		size_t match = table[h];
+		table[h] = i + 1;
+		if (!match-- || i - match > MaxOffset || load32(&src[match]) != u) {
+			i++;
+			continue;
+		}
+		size_t n = MinMatch;
+		while (i + n < len && src[match + n] == src[i + n]) n++;
+		ptr = putSeq(ptr, end, &src[lit], i - lit, i - match, n);
+		if (!ptr) return 0;
+		i += n;
+		lit = i;
+	}
+	ptr = putSeq(ptr, end, &src[lit], len - lit, 0, 0);
+	return (ptr ? (size_t)(ptr - dst) : 0);
+}
+
+static const byte *getLen(const byte *ptr, const byte *end, size_t *len) {
+	for (byte b = 255; b == 255; *len += b) {
+		if (ptr == end) return NULL;
+		b = *ptr++;
+	}
+	return ptr;
+}
+
+int lzUnpack(byte *dst, size_t cap, const byte *src, size_t len) {
+	byte *out = dst, *outEnd = &dst[cap];
+	const byte *ptr = src, *end = &src[len];
+	while (ptr < end) {
+		byte token = *ptr++;
+		size_t litLen = token >> 4;
+		if (litLen == 15 && !(ptr = getLen(ptr, end, &litLen))) return -1;
+		if ((size_t)(end - ptr) < litLen) return -1;
+		if ((size_t)(outEnd - out) < litLen) return -1;
+		memcpy(out, ptr, litLen);
+		out += litLen;
+		ptr += litLen;
+		if (ptr == end) break;
+
+		if (end - ptr < 2) return -1;
+		size_t offset = ptr[0] | ptr[1] << 8;
+		ptr += 2;
+		size_t matchLen = token & 0xF;
+		if (matchLen == 15 && !(ptr = getLen(ptr, end, &matchLen))) return -1;
+		matchLen += MinMatch;
+		if (!offset || offset > (size_t)(out - dst)) return -1;
+		if ((size_t)(outEnd - out) < matchLen) return -1;
+		for (const byte *from = out - offset; matchLen; --matchLen) {
+			*out++ = *from++;
+		}
+	}
+	return (out == outEnd ? 0 : -1);
+}
+
+#ifdef TEST
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+static void roundtrip(const byte *src, size_t len) {
+	size_t cap = lzBound(len);
+	byte *packed = malloc(cap);
+	byte *unpacked = malloc(len + 1);
+	assert(packed && unpacked);
+	size_t n = lzPack(packed, cap, src, len);
+	assert(n || !len);
+	assert(0 == lzUnpack(unpacked, len, packed, n));
+	assert(!memcmp(src, unpacked, len));
+	if (n) assert(0 > lzUnpack(unpacked, len + 1, packed, n));
+	free(packed);
+	free(unpacked);
+}
+
+int main(void) {
+	roundtrip((const byte *)"", 0);
+	roundtrip((const byte *)"a", 1);
+	roundtrip((const byte *)"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 43);
+
+	byte buf[70000];
+	for (size_t i = 0; i < sizeof(buf); ++i) {
+		buf[i] = rand();
+	}
+	roundtrip(buf, sizeof(buf));
+
+	char *ptr = (char *)buf, *end = (char *)&buf[sizeof(buf)];
+	for (int i = 0; ptr != end; ++i) {
+		ptr = seprintf(
+			ptr, end, "\3%02dnick%d\3\tsome message number %d\n",
+			i % 16, i % 7, i
+		);
+	}
+	size_t len = ptr - (char *)buf;
+	roundtrip(buf, len);
+	byte packed[sizeof(buf) * 2];
+	assert(lzPack(packed, sizeof(packed), buf, len) < len / 2);
+	assert(!lzPack(packed, 8, buf, len));
+}
+
+#endif /* TEST */
@@ -0,0 +1,204 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chat.h"
+
+// Notifications run the utility with the window name and message. After
+// a notification, any more in the same window are held for a few seconds
+// and then sent as one, so that a busy window doesn't start a process for
+// every line.
+//
+// The utility is run by a helper shell started once, which reads the
+// window name and message as two lines from a pipe, so that sending a
+// notification is a write rather than a spawn from the client. The helper
+// is started again when it exits.
+
+enum { NotifyDelay = 5 };
+
+struct Util notifyUtil;
+
+static struct {
+	time_t sent;
+	uint count;
+	char *mesg;
+} notes[IDCap];
+static uint pending;
+
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static const char Script[] = "while IFS= read -r name && IFS= read -r mesg;"
+	" do \"$0\" \"$@\" \"$name\" \"$mesg\" </dev/null"
+	" || echo \"$0 exits with status $?\"; done";
+
+static int helper = -1;
+
+static void helperStart(void) {
+	int rw[2];
+	int error = pipe(rw);
+	if (error) err(1, "pipe");
+	fcntl(rw[0], F_SETFD, FD_CLOEXEC);
+	fcntl(rw[1], F_SETFD, FD_CLOEXEC);
+	fcntl(rw[1], F_SETFL, O_NONBLOCK);
+
+	struct Util util = {0};
+	utilPush(&util, "sh");
+	utilPush(&util, "-c");
+	utilPush(&util, Script);
+	for (uint i = 0; i < notifyUtil.argc; ++i) {
+		utilPush(&util, notifyUtil.argv[i]);
+	}
+	error = utilSpawn(&util, (int[]) { rw[0], utilPipe[1], utilPipe[1] });
+	close(rw[0]);
+	if (error) {
+		close(rw[1]);
+		uiFormat(Network, Warm, NULL, "sh: %s", strerror(error));
+		return;
+	}
+	helper = rw[1];
+}
+
+// A helper that has exited leaves the pipe without a reader.
+static bool helperDead(void) {
+	struct pollfd fd = { .fd = helper, .events = POLLOUT };
+	if (poll(&fd, 1, 0) < 0) return false;
+	return fd.revents & (POLLERR | POLLHUP);
+}
+
+void notifyRestart(void) {
+	if (helper < 0 || !helperDead()) return;
+	close(helper);
+	helper = -1;
+	helperStart();
+}
+
+// Each notification is written in one piece no larger than PIPE_BUF, so
+// that it can't be split, and is dropped if the helper has fallen behind.
+// SIGPIPE is ignored while writing, in case the helper has just exited.
+static void post(const char *name, const char *mesg) {
+	if (helper < 0) helperStart();
+	if (helper < 0) return;
+
+	char buf[PIPE_BUF];
+	int len = snprintf(buf, sizeof(buf), "%s\n%s\n", name, mesg);
+	if ((size_t)len >= sizeof(buf)) {
+		len = sizeof(buf) - 1;
+		buf[len - 1] = '\n';
+	}
+	for (char *ptr = &buf[strlen(name) + 1]; ptr < &buf[len - 1]; ++ptr) {
+		if (*ptr == '\n' || *ptr == '\r') *ptr = ' ';
+	}
+
+	void (*handler)(int) = signal(SIGPIPE, SIG_IGN);
+	int error = (write(helper, buf, len) < 0 ? errno : 0);
+	if (error == EPIPE) {
+		close(helper);
+		helper = -1;
+		helperStart();
+		error = 0;
+		if (helper >= 0 && write(helper, buf, len) < 0) error = errno;
+	}
+	signal(SIGPIPE, handler);
+	if (error && error != EAGAIN && error != EINTR && error != EPIPE) {
+		uiFormat(Network, Warm, NULL, "notify: %s", strerror(error));
+	}
+}
+
+void notifyPush(uint id, const char *str) {
+	if (self.restricted) return;
+	if (!notifyUtil.argc) return;
+
+	char buf[1024];
+	styleStrip(buf, sizeof(buf), str);
+
+	time_t t = now();
+	if (
+		!notes[id].count &&
+		(!notes[id].sent || t >= notes[id].sent + NotifyDelay)
+	) {
+		post(idNames[id], buf);
+		notes[id].sent = t;
+		return;
+	}
+
+	if (!notes[id].count++) pending++;
+	free(notes[id].mesg);
+	notes[id].mesg = strdup(buf);
+	if (!notes[id].mesg) err(1, "strdup");
+}
+
+int notifyTimeout(void) {
+	if (!pending) return -1;
+	time_t t = now();
+	time_t left = NotifyDelay;
+	for (uint id = 0; id < IDCap; ++id) {
+		if (!notes[id].count) continue;
+		if (notes[id].sent + NotifyDelay - t < left) {
+			left = notes[id].sent + NotifyDelay - t;
+		}
+	}
+	return (left > 0 ? left * 1000 : 0);
+}
+
+void notifySync(void) {
+	if (!pending) return;
+	time_t t = now();
+	for (uint id = 0; id < IDCap; ++id) {
+		if (!notes[id].count) continue;
+		if (t < notes[id].sent + NotifyDelay) continue;
+		if (notes[id].count > 1) {
+			char buf[1024];
+			snprintf(
+				buf, sizeof(buf), "%u highlights in %s",
+				notes[id].count, idNames[id]
+			);
+			post(idNames[id], buf);
+		} else {
+			post(idNames[id], notes[id].mesg);
+		}
+		free(notes[id].mesg);
+		notes[id].mesg = NULL;
+		notes[id].count = 0;
+		notes[id].sent = t;
+		pending--;
+	}
+}
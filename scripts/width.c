@@ -0,0 +1,66 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+// Generates width.h from the C library's wcwidth(3) in a UTF-8 locale:
+//
+//	cc -o width scripts/width.c && ./width > width.h
+
+#define _XOPEN_SOURCE 700
+
+#include <err.h>
+#include <locale.h>
+#include <stdio.h>
+#include <wchar.h>
+
+enum { Max = 0x110000 };
+
+static int width(unsigned c) {
+	int n = wcwidth(c);
+	return (n < 0 ? 0 : n);
+}
+
+int main(void) {
+	if (!setlocale(LC_CTYPE, "C.UTF-8")) errx(1, "no UTF-8 locale");
+	printf(
+		"// Generated by scripts/width.c. Do not edit.\n"
+		"\n"
+		"// Ranges of code points from U+0080 which are not one column wide.\n"
+		"static const struct Width {\n"
+		"\tuint32_t lo, hi;\n"
+		"\tint width;\n"
+		"} Widths[] = {\n"
+	);
+	unsigned lo = 0x80;
+	for (unsigned c = 0x80; c <= Max; ++c) {
+		if (c < Max && width(c) == width(lo)) continue;
+		if (width(lo) != 1) {
+			printf("\t{ 0x%04X, 0x%04X, %d },\n", lo, c - 1, width(lo));
+		}
+		lo = c;
+	}
+	printf("};\n");
+}
@@ -33,12 +33,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <term.h>
 #include <time.h>
 #include <unistd.h>
@@ -56,8 +59,20 @@
 WINDOW *uiStatus;
 WINDOW *uiMain;
 WINDOW *uiInput;
+bool uiDirect;
 
+// Pairs past the 16 for default backgrounds are allocated as they're needed
+// and found again by a table indexed by foreground and background. Once the
+// terminal runs out, the least recently used pair is redefined.
+enum { ColorBase = 17, ColorMax = 256 };
 static short colorPairs;
+static short colorCap;
+static short colorTable[1 + ColorMax][1 + ColorMax];
+static struct Pair {
+	short fg, bg;
+	short prev, next;
+} *pairs;
+static short pairHead, pairTail;
 
 static void colorInit(void) {
 	start_color();
@@ -66,7 +81,27 @@ static void colorInit(void) {
 	for (short pair = 0; pair < 16; ++pair) {
 		init_pair(1 + pair, pair % COLORS, -1);
 	}
-	colorPairs = 17;
+	colorPairs = ColorBase;
+	colorCap = (COLOR_PAIRS < SHRT_MAX ? COLOR_PAIRS : SHRT_MAX);
+	if (colorCap < ColorBase) colorCap = ColorBase;
+	pairs = calloc(colorCap, sizeof(*pairs));
+	if (!pairs) err(1, "calloc");
+}
+
+static void pairUnlink(short pair) {
+	struct Pair *p = &pairs[pair];
+	if (p->prev) pairs[p->prev].next = p->next;
+	if (p->next) pairs[p->next].prev = p->prev;
+	if (pairHead == pair) pairHead = p->next;
+	if (pairTail == pair) pairTail = p->prev;
+	p->prev = p->next = 0;
+}
+
+static void pairFront(short pair) {
+	pairs[pair].next = pairHead;
+	if (pairHead) pairs[pairHead].prev = pair;
+	pairHead = pair;
+	if (!pairTail) pairTail = pair;
 }
 
 static attr_t colorAttr(short fg) {
@@ -81,13 +116,31 @@ static short colorPair(short fg, short bg) {
 	fg %= COLORS;
 	bg %= COLORS;
 	if (bg == -1 && fg < 16) return 1 + fg;
-	for (short pair = 17; pair < colorPairs; ++pair) {
-		short f, b;
-		pair_content(pair, &f, &b);
-		if (f == fg && b == bg) return pair;
+	assert(fg < ColorMax && bg < ColorMax);
+	short *entry = &colorTable[1 + fg][1 + bg];
+	short pair = *entry;
+	if (pair) {
+		if (pair != pairHead) {
+			pairUnlink(pair);
+			pairFront(pair);
+		}
+		return pair;
 	}
-	init_pair(colorPairs, fg, bg);
-	return colorPairs++;
+	if (colorPairs < colorCap) {
+		pair = colorPairs++;
+	} else if (pairTail) {
+		pair = pairTail;
+		pairUnlink(pair);
+		colorTable[1 + pairs[pair].fg][1 + pairs[pair].bg] = 0;
+	} else {
+		return 0;
+	}
+	init_pair(pair, fg, bg);
+	pairs[pair].fg = fg;
+	pairs[pair].bg = bg;
+	pairFront(pair);
+	*entry = pair;
+	return pair;
 }
 
 // XXX: Assuming terminals will be fine with these even if they're unsupported,
@@ -125,6 +178,8 @@ void uiInit(void) {
 
 	uiMain = newwin(MAIN_LINES, COLS, StatusLines, 0);
 	if (!uiMain) err(1, "newwin");
+	idlok(uiMain, true);
+	if (uiDirect) vtResize(StatusLines, MAIN_LINES, COLS);
 
 	uiInput = newpad(InputLines, InputCols);
 	if (!uiInput) err(1, "newpad");
@@ -138,10 +193,17 @@ static bool hidden = true;
 char uiTitle[TitleCap];
 static char prevTitle[TitleCap];
 
+uint uiFrameRate = 60;
+static struct timespec drawn;
+static bool pending;
+
 void uiDraw(void) {
+	pending = false;
 	if (hidden) return;
+	clock_gettime(CLOCK_MONOTONIC, &drawn);
+	windowDraw();
 	wnoutrefresh(uiStatus);
-	wnoutrefresh(uiMain);
+	if (!uiDirect) wnoutrefresh(uiMain);
 	int y, x;
 	getyx(uiInput, y, x);
 	pnoutrefresh(
@@ -150,8 +212,11 @@ void uiDraw(void) {
 		LINES - InputLines, 0,
 		BOTTOM, RIGHT
 	);
-	(void)y;
 	doupdate();
+	if (uiDirect) {
+		getyx(curscr, y, x);
+		vtFlush(y, x);
+	}
 
 	if (!to_status_line) return;
 	if (!strcmp(uiTitle, prevTitle)) return;
@@ -162,6 +227,31 @@ void uiDraw(void) {
 	fflush(stdout);
 }
 
+// Drawing is limited to uiFrameRate frames per second. Draws which come too
+// soon are put off until uiTimeout runs out.
+static long long frameRemain(void) {
+	if (!uiFrameRate) return 0;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long frame = 1000000000LL / uiFrameRate;
+	long long since = (now.tv_sec - drawn.tv_sec) * 1000000000LL
+		+ (now.tv_nsec - drawn.tv_nsec);
+	return (since < frame ? frame - since : 0);
+}
+
+void uiFrame(void) {
+	if (frameRemain()) {
+		pending = true;
+	} else {
+		uiDraw();
+	}
+}
+
+int uiTimeout(void) {
+	if (!pending) return -1;
+	return (frameRemain() + 999999) / 1000000;
+}
+
 static const short Colors[ColorCap] = {
 	[Default]    = -1,
 	[White]      = 8 + COLOR_WHITE,
@@ -189,6 +279,10 @@ static const short Colors[ColorCap] = {
 	16, 233, 235, 237, 239, 241, 244, 247, 250, 254, 231,
 };
 
+short uiColor(enum Color color) {
+	return Colors[color];
+}
+
 uint uiAttr(struct Style style) {
 	attr_t attr = A_NORMAL;
 	if (style.attr & Bold) attr |= A_BOLD;
@@ -208,12 +302,13 @@ short uiPair(struct Style style) {
 }
 
 void uiShow(void) {
-	if (!hidden) return;
+	if (!hidden || self.headless) return;
 	prevTitle[0] = '\0';
 	putp(FocusMode[true]);
 	putp(PasteMode[true]);
 	fflush(stdout);
 	hidden = false;
+	if (uiDirect) vtInvalidate();
 	windowUnmark();
 }
 
@@ -226,42 +321,31 @@ void uiHide(void) {
 	endwin();
 }
 
-struct Util uiNotifyUtil;
-static void notify(uint id, const char *str) {
-	if (self.restricted) return;
-	if (!uiNotifyUtil.argc) return;
-
-	char buf[1024];
-	styleStrip(buf, sizeof(buf), str);
-
-	struct Util util = uiNotifyUtil;
-	utilPush(&util, idNames[id]);
-	utilPush(&util, buf);
-
-	pid_t pid = fork();
-	if (pid < 0) err(1, "fork");
-	if (pid) return;
-
-	setsid();
-	close(STDIN_FILENO);
-	dup2(utilPipe[1], STDOUT_FILENO);
-	dup2(utilPipe[1], STDERR_FILENO);
-	execvp(util.argv[0], (char *const *)util.argv);
-	warn("%s", util.argv[0]);
-	_exit(127);
+// Without a terminal, only warnings in the network window are shown, on
+// standard error.
+static bool headlessHides(uint id, enum Heat heat) {
+	return self.headless && (id != Network || heat < Warm);
 }
 
 void uiWrite(uint id, enum Heat heat, const time_t *src, const char *str) {
+	if (headlessHides(id, heat)) return;
+	if (self.headless) {
+		char buf[1024];
+		styleStrip(buf, sizeof(buf), str);
+		fprintf(stderr, "%s\n", buf);
+		return;
+	}
 	bool note = windowWrite(id, heat, src, str);
 	if (note) {
 		beep();
-		notify(id, str);
+		notifyPush(id, str);
 	}
 }
 
 void uiFormat(
 	uint id, enum Heat heat, const time_t *time, const char *format, ...
 ) {
+	if (headlessHides(id, heat)) return;
 	char buf[1024];
 	va_list ap;
 	va_start(ap, format);
@@ -274,10 +358,13 @@ void uiFormat(
 void uiResize(void) {
 	wclear(uiMain);
 	wresize(uiMain, MAIN_LINES, COLS);
+	if (uiDirect) vtResize(StatusLines, MAIN_LINES, COLS);
 	windowResize();
 }
 
 static FILE *saveFile;
+static int saveDir = -1;
+static char *saveName;
 
 static const uint64_t Signatures[] = {
 	0x6C72696774616301, // no heat, unread, unreadWarm
@@ -288,7 +375,8 @@ static const uint64_t Signatures[] = {
 	0x6C72696774616306, // no thresh
 	0x6C72696774616307, // no window time
 	0x6C72696774616308, // no input
-	0x6C72696774616309,
+	0x6C72696774616309, // no compact format
+	0x6C7269677461630A,
 };
 
 static size_t signatureVersion(uint64_t signature) {
@@ -302,15 +390,117 @@ static int writeUint64(FILE *file, uint64_t u) {
 	return (fwrite(&u, sizeof(u), 1, file) ? 0 : -1);
 }
 
+// The save file is a header of signature, self.pos, unpacked length,
+// packed length (or 0 if stored) and checksum of the data that follows,
+// then the journal of changes since.
+static int saveWrite(FILE *file) {
+	char *raw = NULL;
+	size_t rawLen = 0;
+	FILE *stream = open_memstream(&raw, &rawLen);
+	if (!stream) return -1;
+	int error = 0
+		|| windowSave(stream)
+		|| inputSave(stream)
+		|| urlSave(stream);
+	error |= fclose(stream);
+	if (error) {
+		free(raw);
+		return error;
+	}
+
+	const byte *data = (const byte *)raw;
+	size_t len = rawLen;
+	size_t cap = lzBound(rawLen);
+	byte *packed = malloc(cap);
+	size_t packedLen = (packed ? lzPack(packed, cap, data, rawLen) : 0);
+	if (packedLen && packedLen < rawLen) {
+		data = packed;
+		len = packedLen;
+	} else {
+		packedLen = 0;
+	}
+
+	error = 0
+		|| writeUint64(file, Signatures[9])
+		|| writeUint64(file, self.pos)
+		|| writeUint64(file, rawLen)
+		|| writeUint64(file, packedLen)
+		|| writeUint64(file, journalChecksum(data, len))
+		|| !fwrite(data, len, 1, file)
+		|| fflush(file);
+	free(packed);
+	free(raw);
+	return error;
+}
+
+// A snapshot is written to a temporary file which then replaces the save
+// file, so that being killed part way through leaves the old one whole.
+static int saveReplace(void) {
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", saveName);
+	int fd = openat(
+		saveDir, tmp, O_RDWR | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC,
+		S_IRUSR | S_IWUSR
+	);
+	if (fd < 0) return -1;
+	FILE *file = fdopen(fd, "a+");
+	if (!file) {
+		close(fd);
+		return -1;
+	}
+	int error = 0
+		|| flock(fd, LOCK_EX | LOCK_NB)
+		|| saveWrite(file)
+		|| fsync(fd)
+		|| renameat(saveDir, tmp, saveDir, saveName)
+		|| fsync(saveDir);
+	if (error) {
+		fclose(file);
+		return error;
+	}
+	fclose(saveFile);
+	saveFile = file;
+	return 0;
+}
+
 int uiSave(void) {
-	return 0
-		|| ftruncate(fileno(saveFile), 0)
-		|| writeUint64(saveFile, Signatures[8])
-		|| writeUint64(saveFile, self.pos)
-		|| windowSave(saveFile)
-		|| inputSave(saveFile)
-		|| urlSave(saveFile)
-		|| fclose(saveFile);
+	journalClose();
+	return saveReplace() || fclose(saveFile);
+}
+
+int uiCompact(void) {
+	int error = saveReplace();
+	if (error) return error;
+	journalInit(fileno(saveFile), ftello(saveFile), 0);
+	return 0;
+}
+
+// The directory of the save file is held for replacing it.
+static void saveFind(const char *name) {
+	struct stat st;
+	int error = fstat(fileno(saveFile), &st);
+	if (error) err(1, "%s", name);
+	char buf[PATH_MAX];
+	for (int i = 0; dataPath(buf, sizeof(buf), name, i); ++i) {
+		struct stat other;
+		if (stat(buf, &other)) continue;
+		if (other.st_dev != st.st_dev || other.st_ino != st.st_ino) continue;
+
+		char *slash = strrchr(buf, '/');
+		saveName = strdup(slash ? &slash[1] : buf);
+		if (!saveName) err(1, "strdup");
+		if (slash) *slash = '\0';
+		saveDir = open(
+			(slash ? buf : "."), O_RDONLY | O_DIRECTORY | O_CLOEXEC
+		);
+		if (saveDir < 0) err(1, "%s", buf);
+#ifdef __OpenBSD__
+		error = unveil(buf, "rwc");
+		if (error) err(1, "unveil");
+#endif
+		return;
+	}
+	errx(1, "%s: save file not found", name);
 }
 
 static uint64_t readUint64(FILE *file) {
@@ -321,17 +511,78 @@ static uint64_t readUint64(FILE *file) {
 	return u;
 }
 
+static void loadMap(const char *name) {
+	uint64_t rawLen = readUint64(saveFile);
+	uint64_t packedLen = readUint64(saveFile);
+	uint64_t sum = readUint64(saveFile);
+	uint64_t len = (packedLen ? packedLen : rawLen);
+	const off_t head = 5 * sizeof(uint64_t);
+
+	struct stat st;
+	int error = fstat(fileno(saveFile), &st);
+	if (error) err(1, "%s", name);
+	if (st.st_size < head || (uint64_t)(st.st_size - head) < len) {
+		errx(1, "%s: truncated save file", name);
+	}
+	int fd = fileno(saveFile);
+	byte *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) err(1, "%s", name);
+
+	const byte *data = &map[head];
+	if (journalChecksum(data, len) != sum) {
+		errx(1, "%s: save file checksum mismatch", name);
+	}
+	byte *raw = NULL;
+	if (packedLen) {
+		raw = malloc(rawLen);
+		if (!raw) err(1, "malloc");
+		error = lzUnpack(raw, rawLen, data, len);
+		if (error) errx(1, "%s: malformed save file", name);
+		data = raw;
+		len = rawLen;
+	}
+
+	size_t used = windowUnpack(data, len);
+	FILE *rest = fmemopen((void *)&data[used], len - used, "r");
+	if (!rest) err(1, "fmemopen");
+	inputLoad(rest, ARRAY_LEN(Signatures) - 1);
+	urlLoad(rest, ARRAY_LEN(Signatures) - 1);
+	fclose(rest);
+	free(raw);
+
+	// A batch cut short by a crash is dropped so that new batches are not
+	// appended after it.
+	off_t snapshot = head + (packedLen ? packedLen : rawLen);
+	off_t journal = journalReplay(&map[snapshot], st.st_size - snapshot);
+	munmap(map, st.st_size);
+	if (snapshot + journal < st.st_size) {
+		error = ftruncate(fd, snapshot + journal);
+		if (error) err(1, "%s", name);
+	}
+	journalInit(fd, snapshot, journal);
+}
+
 void uiLoad(const char *name) {
 	int error;
 	saveFile = dataOpen(name, "a+e");
 	if (!saveFile) exit(1);
 	rewind(saveFile);
+	saveFind(name);
 
 #ifdef __FreeBSD__
 	cap_rights_t rights;
-	cap_rights_init(&rights, CAP_READ, CAP_WRITE, CAP_FLOCK, CAP_FTRUNCATE);
+	cap_rights_init(
+		&rights, CAP_READ, CAP_WRITE, CAP_FLOCK, CAP_FTRUNCATE, CAP_FSYNC,
+		CAP_MMAP_R
+	);
 	error = caph_rights_limit(fileno(saveFile), &rights);
 	if (error) err(1, "cap_rights_limit");
+	cap_rights_set(
+		&rights, CAP_CREATE, CAP_FSTAT, CAP_FCNTL, CAP_SEEK,
+		CAP_RENAMEAT_SOURCE, CAP_RENAMEAT_TARGET
+	);
+	error = caph_rights_limit(saveDir, &rights);
+	if (error) err(1, "cap_rights_limit");
 #endif
 
 	error = flock(fileno(saveFile), LOCK_EX | LOCK_NB);
@@ -343,6 +594,8 @@ void uiLoad(const char *name) {
 	fread(&signature, sizeof(signature), 1, saveFile);
 	if (ferror(saveFile)) err(1, "fread");
 	if (feof(saveFile)) {
+		error = uiCompact();
+		if (error) err(1, "%s", name);
 		return;
 	}
 	size_t version = signatureVersion(signature);
@@ -350,7 +603,15 @@ void uiLoad(const char *name) {
 	if (version > 1) {
 		self.pos = readUint64(saveFile);
 	}
+	if (version > 8) {
+		loadMap(name);
+		return;
+	}
 	windowLoad(saveFile, version);
 	inputLoad(saveFile, version);
 	urlLoad(saveFile, version);
+
+	// Journal entries can only follow a snapshot in the current format.
+	error = uiCompact();
+	if (error) err(1, "%s", name);
 }
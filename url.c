@@ -27,6 +27,7 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <regex.h>
 #include <stdio.h>
@@ -111,6 +112,31 @@ void urlScan(uint id, const char *nick, const char *mesg) {
 	}
 }
 
+// Runs the configured utility, or else the first default one found.
+static void run(
+	const char *kind, const struct Util *util,
+	const struct Util *defaults, size_t len,
+	const char *arg, const int fds[3]
+) {
+	if (util->argc) {
+		defaults = util;
+		len = 1;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		struct Util copy = defaults[i];
+		if (arg) utilPush(&copy, arg);
+		int error = utilSpawn(&copy, fds);
+		if (error == ENOENT && defaults != util) continue;
+		if (error) {
+			uiFormat(
+				Network, Warm, NULL, "%s: %s", copy.argv[0], strerror(error)
+			);
+		}
+		return;
+	}
+	uiFormat(Network, Warm, NULL, "No %s utility found", kind);
+}
+
 struct Util urlOpenUtil;
 static const struct Util OpenUtils[] = {
 	{ 1, { "open" } },
@@ -118,32 +144,10 @@ static const struct Util OpenUtils[] = {
 };
 
 static void urlOpen(const char *url) {
-	pid_t pid = fork();
-	if (pid < 0) err(1, "fork");
-	if (pid) return;
-
-	setsid();
-	close(STDIN_FILENO);
-	dup2(utilPipe[1], STDOUT_FILENO);
-	dup2(utilPipe[1], STDERR_FILENO);
-	if (urlOpenUtil.argc) {
-		struct Util util = urlOpenUtil;
-		utilPush(&util, url);
-		execvp(util.argv[0], (char *const *)util.argv);
-		warn("%s", util.argv[0]);
-		_exit(127);
-	}
-	for (size_t i = 0; i < ARRAY_LEN(OpenUtils); ++i) {
-		struct Util util = OpenUtils[i];
-		utilPush(&util, url);
-		execvp(util.argv[0], (char *const *)util.argv);
-		if (errno != ENOENT) {
-			warn("%s", util.argv[0]);
-			_exit(127);
-		}
-	}
-	warnx("no open utility found");
-	_exit(127);
+	run(
+		"open", &urlOpenUtil, OpenUtils, ARRAY_LEN(OpenUtils), url,
+		(int[]) { -1, utilPipe[1], utilPipe[1] }
+	);
 }
 
 struct Util urlCopyUtil;
@@ -167,32 +171,12 @@ static void urlCopy(const char *url) {
 	error = close(rw[1]);
 	if (error) err(1, "close");
 
-	pid_t pid = fork();
-	if (pid < 0) err(1, "fork");
-	if (pid) {
-		close(rw[0]);
-		return;
-	}
-
-	setsid();
-	dup2(rw[0], STDIN_FILENO);
-	dup2(utilPipe[1], STDOUT_FILENO);
-	dup2(utilPipe[1], STDERR_FILENO);
+	fcntl(rw[0], F_SETFD, FD_CLOEXEC);
+	run(
+		"copy", &urlCopyUtil, CopyUtils, ARRAY_LEN(CopyUtils), NULL,
+		(int[]) { rw[0], utilPipe[1], utilPipe[1] }
+	);
 	close(rw[0]);
-	if (urlCopyUtil.argc) {
-		execvp(urlCopyUtil.argv[0], (char *const *)urlCopyUtil.argv);
-		warn("%s", urlCopyUtil.argv[0]);
-		_exit(127);
-	}
-	for (size_t i = 0; i < ARRAY_LEN(CopyUtils); ++i) {
-		execvp(CopyUtils[i].argv[0], (char *const *)CopyUtils[i].argv);
-		if (errno != ENOENT) {
-			warn("%s", CopyUtils[i].argv[0]);
-			_exit(127);
-		}
-	}
-	warnx("no copy utility found");
-	_exit(127);
 }
 
 void urlOpenCount(uint id, uint count) {
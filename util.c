@@ -0,0 +1,137 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chat.h"
+
+// Utilities are started with posix_spawn(3), which doesn't need to copy
+// the page tables of a client holding a lot of scrollback as fork(2)
+// does. Time spent spawning is shown in the debug window. Utilities may
+// also be started from other threads, which only add to the totals.
+
+extern char **environ;
+
+static struct {
+	pthread_mutex_t mutex;
+	uint count;
+	long total;
+	long max;
+} stats = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static long micros(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void check(int error) {
+	if (!error) return;
+	errno = error;
+	err(1, "posix_spawn");
+}
+
+// Standard input, output and error are replaced by fds, or closed where
+// negative, and the utility is started in a new session. Without fds,
+// it runs in the foreground with the terminal. Threads block all signals,
+// so utilities always start with none blocked.
+static int spawn(const struct Util *util, const int fds[3], long *time) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	check(posix_spawn_file_actions_init(&actions));
+	check(posix_spawnattr_init(&attr));
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	check(posix_spawnattr_setsigmask(&attr, &mask));
+	short flags = POSIX_SPAWN_SETSIGMASK;
+
+	if (fds) {
+		for (int fd = 0; fd < 3; ++fd) {
+			if (fds[fd] < 0) {
+				check(posix_spawn_file_actions_addclose(&actions, fd));
+			} else if (fds[fd] != fd) {
+				check(posix_spawn_file_actions_adddup2(&actions, fds[fd], fd));
+			}
+		}
+#ifdef POSIX_SPAWN_SETSID
+		flags |= POSIX_SPAWN_SETSID;
+#else
+		flags |= POSIX_SPAWN_SETPGROUP;
+#endif
+	}
+	check(posix_spawnattr_setflags(&attr, flags));
+
+	pid_t pid;
+	long start = micros();
+	int error = posix_spawnp(
+		&pid, util->argv[0], &actions, &attr,
+		(char *const *)util->argv, environ
+	);
+	*time = micros() - start;
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	pthread_mutex_lock(&stats.mutex);
+	stats.count++;
+	stats.total += *time;
+	if (*time > stats.max) stats.max = *time;
+	pthread_mutex_unlock(&stats.mutex);
+	return error;
+}
+
+int utilSpawn(const struct Util *util, const int fds[3]) {
+	long time;
+	int error = spawn(util, fds, &time);
+	if (self.debug) {
+		pthread_mutex_lock(&stats.mutex);
+		uint count = stats.count;
+		long total = stats.total, max = stats.max;
+		pthread_mutex_unlock(&stats.mutex);
+		uiFormat(
+			Debug, Cold, NULL,
+			"\3%02dspawn\3\t%s in %ldus, average %ldus, max %ldus of %u",
+			Gray, util->argv[0], time, total / count, max, count
+		);
+	}
+	return error;
+}
+
+// For threads other than the main one, which can't touch the UI.
+int utilSpawnQuiet(const struct Util *util, const int fds[3]) {
+	long time;
+	return spawn(util, fds, &time);
+}
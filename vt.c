@@ -0,0 +1,344 @@
+/* Copyright (C) 2020  June McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify this Program, or any covered work, by linking or
+ * combining it with OpenSSL (or a modified version of that library),
+ * containing parts covered by the terms of the OpenSSL License and the
+ * original SSLeay license, the licensors of this Program grant you
+ * additional permission to convey the resulting work. Corresponding
+ * Source for a non-source form of such a combination shall include the
+ * source code for the parts of OpenSSL used as well as that of the
+ * covered work.
+ */
+
+#include <assert.h>
+#include <curses.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "chat.h"
+
+// Draws the main window straight to the terminal with plain VT sequences.
+// Drawing goes to a back grid of cells, and each frame only the cells which
+// differ from the front grid, what the terminal is showing, are written.
+
+struct Cell {
+	wchar_t ch;
+	wchar_t mark;
+	struct Style style;
+};
+
+enum { Wide = -1 };
+
+static int top, rows, cols;
+static struct Cell *back, *front;
+static bool *damage;
+static bool valid;
+static int cy, cx;
+static struct Style style;
+
+static struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+} out;
+
+static void outAdd(const char *ptr, size_t len) {
+	if (out.len + len > out.cap) {
+		size_t cap = (out.cap ?: 4096);
+		while (cap < out.len + len) cap *= 2;
+		char *buf = realloc(out.buf, cap);
+		if (!buf) err(1, "realloc");
+		out.buf = buf;
+		out.cap = cap;
+	}
+	memcpy(&out.buf[out.len], ptr, len);
+	out.len += len;
+}
+
+static void outFormat(const char *format, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void outFormat(const char *format, ...) {
+	char buf[64];
+	va_list ap;
+	va_start(ap, format);
+	int len = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	assert(len >= 0 && (size_t)len < sizeof(buf));
+	outAdd(buf, len);
+}
+
+static const struct Cell Blank = { L' ', 0, { 0, Default, Default } };
+
+void vtResize(int y, int height, int width) {
+	top = y;
+	rows = (height > 0 ? height : 0);
+	cols = (width > 0 ? width : 0);
+	free(back);
+	free(front);
+	free(damage);
+	back = malloc(sizeof(*back) * rows * cols);
+	front = malloc(sizeof(*front) * rows * cols);
+	damage = calloc(rows, sizeof(*damage));
+	if (!back || !front || !damage) err(1, "malloc");
+	for (int i = 0; i < rows * cols; ++i) {
+		back[i] = Blank;
+	}
+	cy = cx = 0;
+	valid = false;
+}
+
+// Anything else drawing over the whole screen leaves it unknown.
+void vtInvalidate(void) {
+	valid = false;
+}
+
+void vtMove(int y, int x) {
+	cy = y;
+	cx = x;
+}
+
+void vtStyle(struct Style s) {
+	style = s;
+}
+
+void vtPos(int *y, int *x) {
+	*y = cy;
+	*x = cx;
+}
+
+static void put(wchar_t ch) {
+	if (cy < 0 || cy >= rows) return;
+	if (ch == L'\t') {
+		do put(L' '); while (cx % 8 && cx < cols);
+		return;
+	}
+	int width = wcwidth(ch);
+	if (width < 0) return;
+	struct Cell *row = &back[cy * cols];
+	if (!width) {
+		if (cx > 0 && !row[cx - 1].mark) row[cx - 1].mark = ch;
+		return;
+	}
+	if (cx + width > cols) {
+		cx = cols;
+		return;
+	}
+	row[cx] = (struct Cell) { ch, 0, style };
+	if (width > 1) row[cx + 1] = (struct Cell) { Wide, 0, style };
+	cx += width;
+	damage[cy] = true;
+}
+
+int vtAdd(const char *str, size_t len) {
+	mbstate_t state = {0};
+	while (len) {
+		wchar_t ch;
+		size_t n = mbrtowc(&ch, str, len, &state);
+		if (n == (size_t)-1 || n == (size_t)-2) return -1;
+		if (!n) break;
+		put(ch);
+		str += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void vtFill(wchar_t ch, int n) {
+	while (n--) put(ch);
+}
+
+void vtClear(void) {
+	if (cy < 0 || cy >= rows) return;
+	for (int x = cx; x < cols; ++x) {
+		back[cy * cols + x] = Blank;
+	}
+	damage[cy] = true;
+}
+
+// Moves rows from to to on the terminal up by n inside a scrolling region,
+// which moves what's already shown without sending it again.
+static void shift(int from, int to, int n) {
+	struct Cell *row = &front[from * cols];
+	memmove(row, &row[n * cols], sizeof(*row) * (to + 1 - from - n) * cols);
+	for (int i = (to + 1 - n) * cols; i < (to + 1) * cols; ++i) {
+		front[i] = Blank;
+	}
+	outFormat(
+		"\33[m\33[%d;%dr\33[%d;1H", 1 + top + from, 1 + top + to, 1 + top + to
+	);
+	for (int i = 0; i < n; ++i) outAdd("\n", 1);
+	outAdd("\33[r", 3);
+}
+
+void vtScroll(int n) {
+	if (n <= 0) return;
+	if (n > rows) n = rows;
+	memmove(back, &back[n * cols], sizeof(*back) * (rows - n) * cols);
+	memmove(damage, &damage[n], sizeof(*damage) * (rows - n));
+	for (int y = rows - n; y < rows; ++y) {
+		for (int x = 0; x < cols; ++x) {
+			back[y * cols + x] = Blank;
+		}
+		damage[y] = true;
+	}
+	if (valid) shift(0, rows - 1, n);
+}
+
+static bool rowEqual(const struct Cell *a, const struct Cell *b) {
+	return !memcmp(a, b, sizeof(*a) * cols);
+}
+
+// Rows which have moved up since the last frame without a call to vtScroll,
+// such as those below the marker when scrolled back, are moved too.
+enum { ShiftMax = 8 };
+static void findShifts(void) {
+	for (int y = 0; y < rows; ++y) {
+		if (!damage[y]) continue;
+		if (rowEqual(&back[y * cols], &front[y * cols])) continue;
+		for (int n = 1; n <= ShiftMax && y + n < rows; ++n) {
+			int end = y;
+			while (
+				end + n < rows &&
+				rowEqual(&back[end * cols], &front[(end + n) * cols])
+			) end++;
+			if (end - y < 2) continue;
+			shift(y, end - 1 + n, n);
+			y = end - 1;
+			break;
+		}
+	}
+}
+
+static bool styleEqual(struct Style a, struct Style b) {
+	return a.attr == b.attr && a.fg == b.fg && a.bg == b.bg;
+}
+
+static bool cellEqual(const struct Cell *a, const struct Cell *b) {
+	return a->ch == b->ch
+		&& a->mark == b->mark
+		&& styleEqual(a->style, b->style);
+}
+
+static void color(int base, enum Color color) {
+	short c = uiColor(color);
+	if (c < 0) {
+		outFormat(";%d", base + 9);
+	} else if (c < 8) {
+		outFormat(";%d", base + c);
+	} else if (c < 16 && COLORS >= 16) {
+		outFormat(";%d", base + 60 + c - 8);
+	} else if (c < 16) {
+		outFormat(";%d", base + c % 8);
+	} else {
+		outFormat(";%d;5;%d", base + 8, c);
+	}
+}
+
+static void sgr(struct Style s) {
+	if (uiSpoilerReveal && s.fg == s.bg) s.fg = Default;
+	outAdd("\33[0", 3);
+	short fg = uiColor(s.fg);
+	bool bright = (COLORS < 16 && fg >= 8 && fg < 16);
+	if ((s.attr & Bold) || bright) outAdd(";1", 2);
+	if (s.attr & Italic) outAdd(";3", 2);
+	if (s.attr & Underline) outAdd(";4", 2);
+	if (s.attr & Reverse) outAdd(";7", 2);
+	if (COLORS) {
+		color(30, s.fg);
+		color(40, s.bg);
+	}
+	outAdd("m", 1);
+}
+
+static bool blankFrom(const struct Cell *row, int x) {
+	for (; x < cols; ++x) {
+		if (!cellEqual(&row[x], &Blank)) return false;
+	}
+	return true;
+}
+
+static void flushRow(int y) {
+	struct Cell *row = &back[y * cols];
+	struct Cell *shown = &front[y * cols];
+	int x = 0, end = cols;
+	if (valid) {
+		while (x < cols && cellEqual(&row[x], &shown[x])) x++;
+		if (x == cols) return;
+		while (end > x && cellEqual(&row[end - 1], &shown[end - 1])) end--;
+	}
+	while (x > 0 && row[x].ch == Wide) x--;
+	outFormat("\33[%d;%dH", 1 + top + y, 1 + x);
+
+	bool first = true;
+	struct Style prev = {0};
+	for (; x < end; ++x) {
+		if (row[x].ch == Wide) continue;
+		if (first || !styleEqual(row[x].style, prev)) {
+			prev = row[x].style;
+			sgr(prev);
+			first = false;
+		}
+		// Clearing to the end of the line only needs the background.
+		if (cellEqual(&row[x], &Blank) && blankFrom(row, x)) {
+			outAdd("\33[K", 3);
+			break;
+		}
+		char buf[2 * MB_LEN_MAX];
+		mbstate_t state = {0};
+		size_t len = wcrtomb(buf, row[x].ch, &state);
+		if (len == (size_t)-1) {
+			outAdd("?", 1);
+			continue;
+		}
+		if (row[x].mark) {
+			size_t n = wcrtomb(&buf[len], row[x].mark, &state);
+			if (n != (size_t)-1) len += n;
+		}
+		outAdd(buf, len);
+	}
+	memcpy(shown, row, sizeof(*row) * cols);
+}
+
+// Writes the frame in one go, then puts the cursor and attributes back the
+// way curses left them.
+void vtFlush(int y, int x) {
+	if (valid) findShifts();
+	for (int i = 0; i < rows; ++i) {
+		if (!valid || damage[i]) flushRow(i);
+		damage[i] = false;
+	}
+	valid = true;
+	if (!out.len) return;
+	outFormat("\33[m\33[%d;%dH", 1 + y, 1 + x);
+	for (size_t i = 0; i < out.len;) {
+		ssize_t n = write(STDOUT_FILENO, &out.buf[i], out.len - i);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) err(1, "write");
+		i += n;
+	}
+	out.len = 0;
+}
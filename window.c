@@ -30,17 +30,54 @@
 #include <assert.h>
 #include <curses.h>
 #include <err.h>
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "chat.h"
 
 #define MAIN_LINES (LINES - StatusLines - InputLines)
 
+struct Status {
+	uint num;
+	bool show;
+	bool pending;
+	bool mark;
+	bool mute;
+	enum Heat thresh;
+	enum Heat heat;
+	uint unreadWarm;
+	int scroll;
+	enum Color color;
+	char *name;
+};
+
+// Older lines are read back from the logs a page at a time, each into a
+// buffer of its own, counting back from the time of the oldest line in the
+// window's buffer when it was first scrolled past. Only so many pages are
+// kept, and pages at the far end from those being read are dropped, leaving
+// a gap to be read back again from the logs. Lines dropped from the
+// window's buffer meanwhile are kept in a tail of the same size below the
+// pages.
+enum { SpillPage = 256, SpillCap = 16 };
+struct Spill {
+	time_t time;
+	size_t back;
+	size_t front;
+	uint len;
+	struct Buffer *pages[SpillCap];
+	struct Buffer *tail;
+};
+
 static struct Window {
 	uint id;
 	int scroll;
@@ -53,6 +90,10 @@ static struct Window {
 	uint unreadHard;
 	uint unreadWarm;
 	struct Buffer *buffer;
+	struct Spill *spill;
+	bool stale;
+	struct Status status;
+	char segment[256];
 } *windows[IDCap];
 
 static uint count;
@@ -60,9 +101,25 @@ static uint show;
 static uint swap;
 static uint user;
 
+// Window numbers by ID, kept up to date as windows are added, moved and
+// removed. Stale entries are caught by checking the window's ID.
+static uint nums[IDCap];
+
+static void renumber(uint num) {
+	for (; num < count; ++num) {
+		nums[windows[num]->id] = num;
+	}
+}
+
+static uint windowNumFor(uint id) {
+	uint num = nums[id];
+	return (num < count && windows[num]->id == id ? num : count);
+}
+
 static uint windowPush(struct Window *window) {
 	assert(count < IDCap);
 	windows[count] = window;
+	nums[window->id] = count;
 	return count++;
 }
 
@@ -76,6 +133,7 @@ static uint windowInsert(uint num, struct Window *window) {
 	);
 	windows[num] = window;
 	count++;
+	renumber(num);
 	return num;
 }
 
@@ -88,22 +146,37 @@ static struct Window *windowRemove(uint num) {
 		&windows[num + 1],
 		sizeof(*windows) * (count - num)
 	);
+	renumber(num);
 	return window;
 }
 
+static void spillDrop(struct Window *window) {
+	if (!window->spill) return;
+	for (uint i = 0; i < window->spill->len; ++i) {
+		bufferFree(window->spill->pages[i]);
+	}
+	bufferFree(window->spill->tail);
+	free(window->spill);
+	window->spill = NULL;
+	logRelease(window->id);
+}
+
 static void windowFree(struct Window *window) {
 	completeRemove(None, idNames[window->id]);
+	spillDrop(window);
 	bufferFree(window->buffer);
+	free(window->status.name);
 	free(window);
 }
 
 enum Heat windowThreshold = Cold;
 struct Time windowTime = { .format = "%X" };
 
+static size_t scrollbacks[IDCap] = { [None] = BufferCap };
+
 uint windowFor(uint id) {
-	for (uint num = 0; num < count; ++num) {
-		if (windows[num]->id == id) return num;
-	}
+	uint num = windowNumFor(id);
+	if (num < count) return num;
 
 	struct Window *window = calloc(1, sizeof(*window));
 	if (!window) err(1, "malloc");
@@ -116,7 +189,7 @@ uint windowFor(uint id) {
 	} else {
 		window->thresh = windowThreshold;
 	}
-	window->buffer = bufferAlloc();
+	window->buffer = bufferAlloc(scrollbacks[id] ?: scrollbacks[None]);
 	completePush(None, idNames[id], idColors[id]);
 
 	return windowPush(window);
@@ -155,15 +228,83 @@ static int styleAdd(WINDOW *win, struct Style init, const char *str) {
 	return 0;
 }
 
-static void statusUpdate(void) {
+static bool statusEqual(const struct Status *a, const struct Status *b) {
+	return a->num == b->num
+		&& a->show == b->show
+		&& a->pending == b->pending
+		&& a->mark == b->mark
+		&& a->mute == b->mute
+		&& a->thresh == b->thresh
+		&& a->heat == b->heat
+		&& a->unreadWarm == b->unreadWarm
+		&& a->scroll == b->scroll
+		&& a->color == b->color
+		&& !strcmp(a->name, b->name);
+}
+
+// Each window's segment of the status line is only remade when the state it
+// shows changes. Segments start with a reset since they're drawn together.
+static const char *statusSegment(uint num, struct Window *window) {
+	struct Status status = {
+		.num = num,
+		.show = (num == show),
+		.pending = (num != show && inputPending(window->id)),
+		.mark = window->mark,
+		.mute = window->mute,
+		.thresh = window->thresh,
+		.heat = window->heat,
+		.unreadWarm = window->unreadWarm,
+		.scroll = window->scroll,
+		.color = idColors[window->id],
+		.name = idNames[window->id],
+	};
+	if (window->segment[0] && statusEqual(&status, &window->status)) {
+		return window->segment;
+	}
+	// The name is copied, since a rename can reuse its old allocation.
+	char *name = strdup(status.name);
+	if (!name) err(1, "strdup");
+	free(window->status.name);
+	window->status = status;
+	window->status.name = name;
+
+	char *ptr = window->segment, *end = &ptr[sizeof(window->segment)];
+	ptr = seprintf(
+		ptr, end, "\17\3%d%s %u%s%s %s ",
+		status.color, (status.show ? "\26" : ""),
+		num, status.thresh[(const char *[]) { "-", "", "+", "++" }],
+		&"="[!status.mute], status.name
+	);
+	if (status.mark && status.unreadWarm) {
+		ptr = seprintf(
+			ptr, end, "\3%d+%d\3%d ",
+			(status.heat > Warm ? White : status.color),
+			status.unreadWarm, status.color
+		);
+	}
+	if (status.scroll) {
+		ptr = seprintf(ptr, end, "~%d ", status.scroll);
+	}
+	if (status.pending) {
+		ptr = seprintf(ptr, end, "@ ");
+	}
+	return window->segment;
+}
+
+// The status line is only drawn again when it differs from the last.
+static char statusPrev[4096];
+
+static void statusDraw(void) {
 	struct {
 		uint unread;
 		enum Heat heat;
 	} others = { 0, Cold };
 
-	wmove(uiStatus, 0, 0);
+	char bar[sizeof(statusPrev)];
+	char *ptr = bar, *end = &bar[sizeof(bar)];
+	bar[0] = '\0';
 	for (uint num = 0; num < count; ++num) {
-		const struct Window *window = windows[num];
+		struct Window *window = windows[num];
 		if (num != show && !window->scroll && !inputPending(window->id)) {
 			if (window->heat < Warm) continue;
 			if (window->mute && window->heat < Hot) continue;
@@ -172,35 +313,18 @@ static void statusUpdate(void) {
 			others.unread += window->unreadWarm;
 			if (window->heat > others.heat) others.heat = window->heat;
 		}
-		char buf[256], *end = &buf[sizeof(buf)];
-		char *ptr = seprintf(
-			buf, end, "\3%d%s %u%s%s %s ",
-			idColors[window->id], (num == show ? "\26" : ""),
-			num, window->thresh[(const char *[]) { "-", "", "+", "++" }],
-			&"="[!window->mute], idNames[window->id]
-		);
-		if (window->mark && window->unreadWarm) {
-			ptr = seprintf(
-				ptr, end, "\3%d+%d\3%d ",
-				(window->heat > Warm ? White : idColors[window->id]),
-				window->unreadWarm, idColors[window->id]
-			);
-		}
-		if (window->scroll) {
-			ptr = seprintf(ptr, end, "~%d ", window->scroll);
-		}
-		if (num != show && inputPending(window->id)) {
-			ptr = seprintf(ptr, end, "@ ");
-		}
-		if (styleAdd(uiStatus, StyleDefault, buf) < 0) break;
+		ptr = seprintf(ptr, end, "%s", statusSegment(num, window));
+	}
+	if (strcmp(bar, statusPrev)) {
+		strcpy(statusPrev, bar);
+		wmove(uiStatus, 0, 0);
+		styleAdd(uiStatus, StyleDefault, bar);
+		wclrtoeol(uiStatus);
 	}
-	wclrtoeol(uiStatus);
 
 	const struct Window *window = windows[show];
-	char *end = &uiTitle[sizeof(uiTitle)];
-	char *ptr = seprintf(
-		uiTitle, end, "%s %s", network.name, idNames[window->id]
-	);
+	end = &uiTitle[sizeof(uiTitle)];
+	ptr = seprintf(uiTitle, end, "%s %s", network.name, idNames[window->id]);
 	if (window->mark && window->unreadWarm) {
 		ptr = seprintf(
 			ptr, end, " +%d%s", window->unreadWarm, &"!"[window->heat < Hot]
@@ -213,62 +337,328 @@ static void statusUpdate(void) {
 	}
 }
 
+// Lines paged back in from the logs are shown above the window's buffer.
+static size_t pagesLen(const struct Window *window) {
+	if (!window->spill) return 0;
+	size_t len = 0;
+	for (uint i = 0; i < window->spill->len; ++i) {
+		len += bufferHardLen(window->spill->pages[i]);
+	}
+	return len;
+}
+
+static size_t spillLen(const struct Window *window) {
+	if (!window->spill) return 0;
+	return pagesLen(window) + bufferHardLen(window->spill->tail);
+}
+
+static size_t hardLen(const struct Window *window) {
+	return spillLen(window) + bufferHardLen(window->buffer);
+}
+
+// Returns the buffer holding a hard line, making its index relative to it.
+static const struct Buffer *hardPart(const struct Window *window, size_t *i) {
+	const struct Spill *spill = window->spill;
+	for (uint n = 0; spill && n <= spill->len; ++n) {
+		const struct Buffer *part = (
+			n < spill->len ? spill->pages[n] : spill->tail
+		);
+		size_t len = bufferHardLen(part);
+		if (*i < len) return part;
+		*i -= len;
+	}
+	return window->buffer;
+}
+
+static const struct View *hardLine(const struct Window *window, size_t i) {
+	const struct Buffer *part = hardPart(window, &i);
+	return bufferHard(part, i);
+}
+
+// Indices wrap around below zero when there are fewer lines than rows, which
+// hardLine treats as empty lines.
 static size_t windowTop(const struct Window *window) {
-	size_t top = BufferCap - MAIN_LINES - window->scroll;
+	size_t top = hardLen(window) - MAIN_LINES - window->scroll;
 	if (window->scroll) top += MarkerLines;
 	return top;
 }
 
 static size_t windowBottom(const struct Window *window) {
-	size_t bottom = BufferCap - (window->scroll ?: 1);
+	size_t bottom = hardLen(window) - (window->scroll ?: 1);
 	if (window->scroll) bottom -= SplitLines + MarkerLines;
 	return bottom;
 }
 
-static void mainAdd(int y, bool time, const struct Line *line) {
-	int ny, nx;
-	wmove(uiMain, y, 0);
-	if (!line || !line->str[0]) {
+// The main window is drawn either through curses or straight to the
+// terminal by vt.c.
+static void mainMove(int y, int x) {
+	if (uiDirect) {
+		vtMove(y, x);
+	} else {
+		wmove(uiMain, y, x);
+	}
+}
+
+static void mainStyle(struct Style style) {
+	if (uiDirect) {
+		vtStyle(style);
+	} else {
+		wattr_set(uiMain, uiAttr(style), uiPair(style), NULL);
+	}
+}
+
+static int mainText(const char *str, size_t len) {
+	if (uiDirect) return vtAdd(str, len);
+	return (waddnstr(uiMain, str, len) == ERR ? -1 : 0);
+}
+
+static void mainFill(wchar_t ch, int n) {
+	if (uiDirect) {
+		vtFill(ch, n);
+	} else {
+		for (int i = 0; i < n; ++i) waddnwstr(uiMain, &ch, 1);
+	}
+}
+
+static void mainClear(void) {
+	if (uiDirect) {
+		vtClear();
+	} else {
 		wclrtoeol(uiMain);
+	}
+}
+
+static int mainRow(void) {
+	int y, x;
+	if (uiDirect) {
+		vtPos(&y, &x);
+	} else {
+		getyx(uiMain, y, x);
+	}
+	(void)x;
+	return y;
+}
+
+// ncurses likes to render these as spaces when they should be zero-width, so
+// they're left out of the wrapped text as it's drawn. The stored line keeps
+// them, as does the save file.
+static bool zeroWidth(const char *str, size_t len) {
+	// U+200B and U+200C in UTF-8.
+	return len >= 3
+		&& str[0] == '\xE2' && str[1] == '\x80'
+		&& (str[2] == '\x8B' || str[2] == '\x8C');
+}
+
+static int mainStrip(const char *str, size_t len) {
+	while (len) {
+		size_t n = 0;
+		while (n < len && !zeroWidth(&str[n], len - n)) n++;
+		if (n && mainText(str, n)) return -1;
+		if (n < len) n += 3;
+		str += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int viewAdd(const struct View *view) {
+	struct Style style = StyleDefault;
+	mainStyle(style);
+	mainFill(L' ', view->align);
+
+	// The first tab is rendered as a space.
+	const char *tab = strchr(view->line->str, '\t');
+	const char *str = &view->line->str[view->off];
+	const char *end = &str[view->len];
+	style = view->style;
+	while (str < end) {
+		size_t len = styleParse(&style, &str);
+		if (len > (size_t)(end - str)) len = end - str;
+		if (!len) continue;
+		if (tab && tab >= str && tab < &str[len]) len = (tab - str ?: 1);
+		mainStyle(style);
+		int error = (str == tab)
+			? mainText(" ", 1)
+			: mainStrip(str, len);
+		if (error) return -1;
+		str += len;
+	}
+	return 0;
+}
+
+// Formatted timestamps are cached by time, and a time in the same minute as
+// the last one broken down reuses it rather than calling localtime(3). A
+// change of format empties the cache, as does a change of time zone, which
+// localtime(3) may pick up from TZ or the system on any call. The zone is
+// also looked up again with tzset(3) each hour, in case every time drawn
+// is already cached.
+enum { StampCap = 256 };
+static struct {
+	const char *format;
+	time_t hour;
+	char zone[2][64];
+	time_t minute;
+	struct tm tm;
+	struct {
+		time_t time;
+		char str[TimeCap];
+	} cache[StampCap];
+} stamps;
+
+static void stampZone(void) {
+	for (int i = 0; i < 2; ++i) {
+		const char *name = (tzname[i] ? tzname[i] : "");
+		if (!strcmp(stamps.zone[i], name)) continue;
+		snprintf(stamps.zone[i], sizeof(stamps.zone[i]), "%s", name);
+		stamps.minute = 0;
+		memset(stamps.cache, 0, sizeof(stamps.cache));
+	}
+}
+
+static void stampHour(void) {
+	time_t hour = time(NULL) / 3600;
+	if (hour == stamps.hour) return;
+	stamps.hour = hour;
+	tzset();
+	stampZone();
+}
+
+static const char *stamp(time_t time) {
+	if (stamps.format != windowTime.format) {
+		memset(&stamps, 0, sizeof(stamps));
+		stamps.format = windowTime.format;
+	}
+	stampHour();
+	uint i = (uint64_t)time % StampCap;
+	if (time && stamps.cache[i].time == time) return stamps.cache[i].str;
+
+	if (stamps.minute && time >= stamps.minute && time < stamps.minute + 60) {
+		stamps.tm.tm_sec = time - stamps.minute;
+	} else {
+		struct tm *tm = localtime(&time);
+		if (!tm) err(1, "localtime");
+		stampZone();
+		stamps.tm = *tm;
+		stamps.minute = (tm->tm_sec < 60 ? time - tm->tm_sec : 0);
+	}
+	strftime(
+		stamps.cache[i].str, sizeof(stamps.cache[i].str),
+		windowTime.format, &stamps.tm
+	);
+	stamps.cache[i].time = time;
+	return stamps.cache[i].str;
+}
+
+// Only the first hard line of a soft line is timestamped.
+static void mainAdd(int y, bool time, const struct View *view) {
+	mainMove(y, 0);
+	if (!view || !view->len) {
+		mainClear();
 		return;
 	}
-	if (time && line->time) {
-		char buf[TimeCap];
-		strftime(buf, sizeof(buf), windowTime.format, localtime(&line->time));
-		struct Style init = { .fg = Gray, .bg = Default };
-		styleAdd(uiMain, init, buf);
-		waddch(uiMain, ' ');
+	if (time && !view->off && view->line->time) {
+		struct Style style = { .fg = Gray, .bg = Default };
+		for (const char *str = stamp(view->line->time); *str;) {
+			size_t len = styleParse(&style, &str);
+			if (!len) continue;
+			mainStyle(style);
+			mainText(str, len);
+			str += len;
+		}
+		mainStyle(StyleDefault);
+		mainText(" ", 1);
 	} else if (time) {
-		whline(uiMain, ' ', windowTime.width);
-		wmove(uiMain, y, windowTime.width);
+		mainStyle(StyleDefault);
+		mainFill(L' ', windowTime.width);
 	}
-	styleAdd(uiMain, StyleDefault, line->str);
-	getyx(uiMain, ny, nx);
-	if (ny != y) return;
-	wclrtoeol(uiMain);
-	(void)nx;
+	viewAdd(view);
+	if (mainRow() != y) return;
+	mainClear();
 }
 
-static void mainUpdate(void) {
+static void mainDraw(void) {
 	const struct Window *window = windows[show];
 
-	int y = 0;
+	size_t top = windowTop(window);
 	int marker = MAIN_LINES - SplitLines - MarkerLines;
-	for (size_t i = windowTop(window); i < BufferCap; ++i) {
-		mainAdd(y++, window->time, bufferHard(window->buffer, i));
-		if (window->scroll && y == marker) break;
+	for (int y = 0; y < (window->scroll ? marker : MAIN_LINES); ++y) {
+		mainAdd(y, window->time, hardLine(window, top + y));
 	}
 	if (!window->scroll) return;
 
-	y = MAIN_LINES - SplitLines;
-	for (size_t i = BufferCap - SplitLines; i < BufferCap; ++i) {
-		mainAdd(y++, window->time, bufferHard(window->buffer, i));
+	size_t split = hardLen(window) - SplitLines;
+	for (int y = 0; y < SplitLines; ++y) {
+		mainAdd(
+			MAIN_LINES - SplitLines + y, window->time,
+			hardLine(window, split + y)
+		);
+	}
+	if (uiDirect) {
+		vtMove(marker, 0);
+		vtStyle(StyleDefault);
+		vtFill((MB_CUR_MAX > 1 ? L'\u00B7' : L'.'), COLS);
+	} else {
+		wattr_set(uiMain, A_NORMAL, 0, NULL);
+		mvwhline(uiMain, marker, 0, ACS_BULLET, COLS);
+	}
+}
+
+// Lines added to the bottom scroll the rows above them up, so only the new
+// rows are drawn.
+static void mainScroll(int lines) {
+	const struct Window *window = windows[show];
+	if (window->scroll || lines >= MAIN_LINES) {
+		mainDraw();
+		return;
+	}
+
+	if (uiDirect) {
+		vtScroll(lines);
+	} else {
+		scrollok(uiMain, true);
+		wscrl(uiMain, lines);
+		scrollok(uiMain, false);
+	}
+	size_t top = windowTop(window);
+	for (int y = MAIN_LINES - lines; y < MAIN_LINES; ++y) {
+		mainAdd(y, window->time, hardLine(window, top + y));
+	}
+}
+
+// Updates only mark what needs drawing, and are drawn once per frame.
+static struct {
+	bool status;
+	bool main;
+	int lines;
+} dirty;
+
+static void statusUpdate(void) {
+	dirty.status = true;
+	journalMark();
+}
+
+static void mainUpdate(void) {
+	dirty.main = true;
+}
+
+static void mainAppend(int lines) {
+	dirty.lines += lines;
+}
+
+void windowDraw(void) {
+	if (dirty.status) statusDraw();
+	if (dirty.main) {
+		mainDraw();
+	} else if (dirty.lines) {
+		mainScroll(dirty.lines);
 	}
-	wattr_set(uiMain, A_NORMAL, 0, NULL);
-	mvwhline(uiMain, marker, 0, ACS_BULLET, COLS);
+	dirty.status = false;
+	dirty.main = false;
+	dirty.lines = 0;
 }
 
 void windowUpdate(void) {
+	statusPrev[0] = '\0';
 	statusUpdate();
 	mainUpdate();
 }
@@ -278,24 +668,23 @@ void windowBare(void) {
 	inputWait();
 
 	const struct Window *window = windows[show];
-	const struct Line *line = bufferHard(window->buffer, windowBottom(window));
+	const struct View *view = bufferHard(
+		window->buffer, windowBottom(window) - spillLen(window)
+	);
 
 	uint num = 0;
-	if (line) num = line->num;
-	for (size_t i = 0; i < BufferCap; ++i) {
-		line = bufferSoft(window->buffer, i);
-		if (!line) continue;
+	if (view) num = view->line->num;
+	for (size_t i = 0; i < bufferSoftLen(window->buffer); ++i) {
+		const struct Line *line = bufferSoft(window->buffer, i);
 		if (line->num > num) break;
 		if (!line->str[0]) {
 			printf("\n");
 			continue;
 		}
 
-		char buf[TimeCap];
 		struct Style style = { .fg = Gray, .bg = Default };
-		strftime(buf, sizeof(buf), windowTime.format, localtime(&line->time));
 		vid_attr(uiAttr(style), uiPair(style), NULL);
-		printf("%s ", buf);
+		printf("%s ", stamp(line->time));
 
 		bool align = false;
 		style = StyleDefault;
@@ -333,13 +722,94 @@ static void unmark(struct Window *window) {
 	statusUpdate();
 }
 
+static int windowCols(const struct Window *window) {
+	return COLS - (window->time ? windowTime.width : 0);
+}
+
+// The spill is dropped again when scrolled back to the bottom.
+static void spillOlder(struct Window *window) {
+	if (!window->spill) {
+		window->spill = calloc(1, sizeof(*window->spill));
+		if (!window->spill) err(1, "calloc");
+		const struct Line *first = bufferSoft(window->buffer, 0);
+		window->spill->time = (first ? first->time : time(NULL));
+		window->spill->tail = bufferAlloc(SpillPage * SpillCap);
+	}
+	struct Spill *spill = window->spill;
+	size_t back = logDepth(window->id, spill->time, spill->back + SpillPage);
+	if (back <= spill->back) return;
+
+	struct Buffer *page = bufferAlloc(SIZE_MAX);
+	logRead(
+		window->id, back, back - spill->back,
+		page, windowCols(window), window->thresh
+	);
+	spill->back = back;
+
+	// The newest page is below the view, which stays where it is.
+	if (spill->len == SpillCap) {
+		struct Buffer *newest = spill->pages[--spill->len];
+		spill->front += bufferSoftLen(newest);
+		window->scroll -= bufferHardLen(newest);
+		bufferFree(newest);
+	}
+	memmove(
+		&spill->pages[1], &spill->pages[0],
+		sizeof(*spill->pages) * spill->len
+	);
+	spill->pages[0] = page;
+	spill->len++;
+}
+
+// Pages dropped below the view are read back as it reaches the gap.
+static void spillNewer(struct Window *window) {
+	struct Spill *spill = window->spill;
+	while (spill && spill->front && windowBottom(window) >= pagesLen(window)) {
+		size_t count = (spill->front < SpillPage ? spill->front : SpillPage);
+		struct Buffer *page = bufferAlloc(SIZE_MAX);
+		logRead(
+			window->id, spill->front, count,
+			page, windowCols(window), window->thresh
+		);
+		spill->front -= count;
+
+		if (spill->len == SpillCap) {
+			struct Buffer *oldest = spill->pages[0];
+			spill->back -= bufferSoftLen(oldest);
+			bufferFree(oldest);
+			memmove(
+				&spill->pages[0], &spill->pages[1],
+				sizeof(*spill->pages) * --spill->len
+			);
+		}
+		spill->pages[spill->len++] = page;
+		window->scroll += bufferHardLen(page);
+	}
+}
+
+// Called once a compressed day of the logs has been read, for a window
+// still scrolled back.
+void windowSpill(uint id) {
+	uint num = windowNumFor(id);
+	if (num == count) return;
+	struct Window *window = windows[num];
+	if (!window->scroll) return;
+	spillOlder(window);
+	if (num == show) mainUpdate();
+}
+
 static void scrollN(struct Window *window, int n) {
 	mark(window);
 	window->scroll += n;
-	if (window->scroll > BufferCap - MAIN_LINES) {
-		window->scroll = BufferCap - MAIN_LINES;
+	int max = (int)hardLen(window) - MAIN_LINES;
+	if (n > 0 && window->scroll > max) {
+		spillOlder(window);
+		max = (int)hardLen(window) - MAIN_LINES;
 	}
+	if (window->scroll > max) window->scroll = max;
 	if (window->scroll < 0) window->scroll = 0;
+	if (n < 0 && window->scroll) spillNewer(window);
+	if (!window->scroll) spillDrop(window);
 	unmark(window);
 	if (window == windows[show]) mainUpdate();
 }
@@ -349,23 +819,46 @@ static void scrollTo(struct Window *window, int top) {
 	scrollN(window, top - MAIN_LINES + MarkerLines);
 }
 
-static int windowCols(const struct Window *window) {
-	return COLS - (window->time ? windowTime.width : 0);
+static void journalLine(
+	const struct Window *window, enum Heat heat, time_t time, const char *str
+);
+static void journalRemove(const struct Window *window);
+
+// Lines about to be dropped from the buffer move onto the end of the
+// spill's tail. Lines the tail drops in turn are below a view in the pages.
+static int windowPushLine(
+	struct Window *window, enum Heat heat, time_t time, const char *str
+) {
+	size_t cap = scrollbacks[window->id] ?: scrollbacks[None];
+	const struct Line *line = bufferSoft(window->buffer, 0);
+	journalLine(window, heat, time, str);
+	if (window->spill && line && bufferSoftLen(window->buffer) >= cap) {
+		struct Buffer *tail = window->spill->tail;
+		size_t len = bufferHardLen(tail);
+		bool above = windowTop(window) < pagesLen(window);
+		len += bufferPush(
+			tail, windowCols(window), window->thresh,
+			line->heat, line->time, line->str
+		);
+		if (above) window->scroll -= len - bufferHardLen(tail);
+	}
+	return bufferPush(
+		window->buffer, windowCols(window), window->thresh, heat, time, str
+	);
 }
 
 bool windowWrite(uint id, enum Heat heat, const time_t *src, const char *str) {
 	struct Window *window = windows[windowFor(id)];
 	time_t ts = (src ? *src : time(NULL));
 
+	int marker = 0;
 	if (heat >= window->thresh) {
 		if (!window->unreadSoft++) window->unreadHard = 0;
 	}
 	if (window->mark && heat > Cold) {
 		if (!window->unreadWarm++) {
-			int lines = bufferPush(
-				window->buffer, windowCols(window),
-				window->thresh, Warm, ts, ""
-			);
+			int lines = windowPushLine(window, Warm, ts, "");
+			marker = lines;
 			if (window->scroll) scrollN(window, lines);
 			if (window->unreadSoft > 1) {
 				window->unreadSoft++;
@@ -375,38 +868,126 @@ bool windowWrite(uint id, enum Heat heat, const time_t *src, const char *str) {
 		if (heat > window->heat) window->heat = heat;
 		statusUpdate();
 	}
-	int lines = bufferPush(
-		window->buffer, windowCols(window),
-		window->thresh, heat, ts, str
-	);
+	int lines = windowPushLine(window, heat, ts, str);
 	window->unreadHard += lines;
 	if (window->scroll) scrollN(window, lines);
-	if (window == windows[show]) mainUpdate();
+	if (window == windows[show]) mainAppend(marker + lines);
 
 	return window->mark && heat > Warm;
 }
 
-static void reflow(struct Window *window) {
-	uint num = 0;
-	const struct Line *line = bufferHard(window->buffer, windowTop(window));
-	if (line) num = line->num;
+// Reflowing is split so that the buffers of many windows can be reflowed in
+// parallel, while finding the scroll position again stays on the main thread.
+struct Reflow {
+	struct Window *window;
+	int cols;
+	const struct Buffer *part;
+	uint num;
+};
+
+static void reflowStart(struct Reflow *re, struct Window *window) {
+	re->window = window;
+	re->cols = windowCols(window);
+	re->num = 0;
+	size_t top = windowTop(window);
+	re->part = hardPart(window, &top);
+	const struct View *view = bufferHard(re->part, top);
+	if (view) re->num = view->line->num;
+}
+
+static void reflowWork(struct Reflow *re) {
+	struct Window *window = re->window;
+	struct Spill *spill = window->spill;
+	for (uint i = 0; spill && i < spill->len; ++i) {
+		bufferReflow(spill->pages[i], re->cols, window->thresh, 0);
+	}
+	if (spill) bufferReflow(spill->tail, re->cols, window->thresh, 0);
 	window->unreadHard = bufferReflow(
-		window->buffer, windowCols(window),
-		window->thresh, window->unreadSoft
+		window->buffer, re->cols, window->thresh, window->unreadSoft
 	);
-	if (!window->scroll || !num) return;
-	for (size_t i = 0; i < BufferCap; ++i) {
-		line = bufferHard(window->buffer, i);
-		if (!line || line->num != num) continue;
-		scrollTo(window, BufferCap - i);
+}
+
+static void reflowFinish(struct Reflow *re) {
+	struct Window *window = re->window;
+	if (!window->scroll || !re->num) return;
+	size_t len = hardLen(window);
+	for (size_t i = 0; i < len; ++i) {
+		size_t j = i;
+		if (hardPart(window, &j) != re->part) continue;
+		const struct View *view = bufferHard(re->part, j);
+		if (view->line->num != re->num) continue;
+		scrollTo(window, len - i);
 		break;
 	}
 }
 
-void windowResize(void) {
+static void reflow(struct Window *window) {
+	struct Reflow re;
+	reflowStart(&re, window);
+	reflowWork(&re);
+	reflowFinish(&re);
+}
+
+enum { ThreadCap = 8 };
+
+static struct {
+	struct Reflow list[IDCap];
+	uint len;
+	atomic_uint next;
+} reflows;
+
+static void *reflowThread(void *arg) {
+	(void)arg;
+	for (;;) {
+		uint i = atomic_fetch_add(&reflows.next, 1);
+		if (i >= reflows.len) break;
+		reflowWork(&reflows.list[i]);
+	}
+	return NULL;
+}
+
+// Windows which have never been shown are left to be flowed when they are.
+static void reflowAll(void) {
+	reflows.len = 0;
+	atomic_store(&reflows.next, 0);
 	for (uint num = 0; num < count; ++num) {
-		reflow(windows[num]);
+		if (windows[num]->stale) continue;
+		reflowStart(&reflows.list[reflows.len++], windows[num]);
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint threads = (cpus > ThreadCap ? ThreadCap : cpus > 1 ? cpus : 1);
+	if (threads > reflows.len) threads = reflows.len;
+	pthread_t thread[ThreadCap];
+
+	// Leave signals to the main thread.
+	sigset_t mask, prev;
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &prev);
+	for (uint i = 1; i < threads; ++i) {
+		int error = pthread_create(&thread[i], NULL, reflowThread, NULL);
+		if (error) {
+			errno = error;
+			err(1, "pthread_create");
+		}
 	}
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	reflowThread(NULL);
+	for (uint i = 1; i < threads; ++i) {
+		int error = pthread_join(thread[i], NULL);
+		if (error) {
+			errno = error;
+			err(1, "pthread_join");
+		}
+	}
+
+	for (uint i = 0; i < reflows.len; ++i) {
+		reflowFinish(&reflows.list[i]);
+	}
+}
+
+void windowResize(void) {
+	reflowAll();
 	windowUpdate();
 }
 
@@ -418,8 +999,15 @@ uint windowNum(void) {
 	return show;
 }
 
+static void unstale(struct Window *window) {
+	if (!window->stale) return;
+	window->stale = false;
+	reflow(window);
+}
+
 void windowShow(uint num) {
-	if (num >= count) return;
+	if (num >= count || self.headless) return;
+	unstale(windows[num]);
 	if (num != show) {
 		swap = show;
 		mark(windows[swap]);
@@ -477,6 +1065,7 @@ void windowClose(uint num) {
 	if (num >= count) return;
 	if (windows[num]->id == Network) return;
 	struct Window *window = windowRemove(num);
+	journalRemove(window);
 	completeRemove(window->id, NULL);
 	windowFree(window);
 	if (swap >= num) swap--;
@@ -532,6 +1121,20 @@ void windowToggleThresh(int n) {
 	windowUpdate();
 }
 
+size_t windowScrollback(uint id, size_t cap) {
+	if (!cap) return scrollbacks[id] ?: scrollbacks[None];
+	scrollbacks[id] = cap;
+	for (uint num = 0; num < count; ++num) {
+		if (id != None && windows[num]->id != id) continue;
+		if (id == None && scrollbacks[windows[num]->id]) continue;
+		spillDrop(windows[num]);
+		bufferTrim(windows[num]->buffer, cap);
+		if (windows[num]->scroll) scrollN(windows[num], 0);
+	}
+	if (count && (windows[show]->id == id || id == None)) mainUpdate();
+	return cap;
+}
+
 bool windowTimeEnable(void) {
 	return windows[show]->time;
 }
@@ -550,22 +1153,19 @@ void windowScroll(enum Scroll by, int n) {
 				scrollTo(window, 0);
 				break;
 			}
-			for (size_t i = 0; i < BufferCap; ++i) {
-				if (!bufferHard(window->buffer, i)) continue;
-				scrollTo(window, BufferCap - i);
-				break;
-			}
+			scrollTo(window, hardLen(window));
 		}
 		break; case ScrollUnread: {
 			scrollTo(window, window->unreadHard);
 		}
 		break; case ScrollHot: {
-			for (size_t i = windowTop(window) + n; i < BufferCap; i += n) {
-				const struct Line *line = bufferHard(window->buffer, i);
-				const struct Line *prev = bufferHard(window->buffer, i - 1);
-				if (!line || line->heat < Hot) continue;
-				if (prev && prev->heat > Warm) continue;
-				scrollTo(window, BufferCap - i);
+			size_t len = hardLen(window);
+			for (size_t i = windowTop(window) + n; i < len; i += n) {
+				const struct View *view = hardLine(window, i);
+				const struct View *prev = hardLine(window, i - 1);
+				if (view->line->heat < Hot) continue;
+				if (prev && prev->line->heat > Warm) continue;
+				scrollTo(window, len - i);
 				break;
 			}
 		}
@@ -574,48 +1174,177 @@ void windowScroll(enum Scroll by, int n) {
 
 void windowSearch(const char *str, int dir) {
 	struct Window *window = windows[show];
-	for (size_t i = windowTop(window) + dir; i < BufferCap; i += dir) {
-		const struct Line *line = bufferHard(window->buffer, i);
-		if (!line || !strcasestr(line->str, str)) continue;
-		scrollTo(window, BufferCap - i);
+	size_t len = hardLen(window);
+	for (size_t i = windowTop(window) + dir; i < len; i += dir) {
+		const struct View *view = hardLine(window, i);
+		if (view->off || !strcasestr(view->line->str, str)) continue;
+		scrollTo(window, len - i);
 		break;
 	}
 }
 
-static int writeTime(FILE *file, time_t time) {
-	return (fwrite(&time, sizeof(time), 1, file) ? 0 : -1);
+// Searches across all windows list their hits in a window of their own,
+// from which /jump shows a hit in its window.
+static const char SearchName[] = "<search>";
+
+// Result windows are replaced by each search and never saved.
+static bool results(uint id) {
+	return !strcmp(idNames[id], SearchName)
+		|| !strcmp(idNames[id], logGrepName);
+}
+
+uint windowResults(const char *name) {
+	uint id = idFor(name);
+	uint num = windowNumFor(id);
+	if (num < count) windowClose(num);
+	return id;
+}
+
+enum { HitCap = 1024 };
+static struct Hit {
+	uint id;
+	uint num;
+} hits[HitCap];
+static size_t hitsLen;
+
+void windowFind(const char *pattern) {
+	regex_t regex;
+	bool re = false;
+	size_t len = strlen(pattern);
+	if (len > 2 && pattern[0] == '/' && pattern[len - 1] == '/') {
+		char *copy = strndup(&pattern[1], len - 2);
+		if (!copy) err(1, "strndup");
+		int error = regcomp(&regex, copy, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+		free(copy);
+		if (error) {
+			char buf[256];
+			regerror(error, &regex, buf, sizeof(buf));
+			uiFormat(Network, Warm, NULL, "%s: %s", pattern, buf);
+			return;
+		}
+		re = true;
+	}
+
+	uint search = idFor(SearchName);
+	hitsLen = 0;
+	for (uint num = 0; num < count; ++num) {
+		const struct Window *window = windows[num];
+		if (window->id == search) continue;
+		size_t lines = bufferSoftLen(window->buffer);
+		for (size_t i = 0; i < lines && hitsLen < HitCap; ++i) {
+			if (!re) i = bufferFind(window->buffer, i, pattern);
+			if (i == lines) break;
+			const struct Line *line = bufferPeek(window->buffer, i);
+			if (re && regexec(&regex, line->str, 0, NULL, 0)) continue;
+			hits[hitsLen++] = (struct Hit) { window->id, line->num };
+		}
+	}
+	if (re) regfree(&regex);
+
+	windowResults(SearchName);
+	uiFormat(
+		search, Cold, NULL, "%zu%s results for %s",
+		hitsLen, (hitsLen == HitCap ? " or more" : ""), pattern
+	);
+	for (size_t n = 0; n < hitsLen; ++n) {
+		const struct Buffer *buffer = windows[windowNumFor(hits[n].id)]->buffer;
+		const struct Line *line = bufferPeek(
+			buffer, hits[n].num - bufferPeek(buffer, 0)->num
+		);
+		uiFormat(
+			search, Cold, &line->time, "[%zu] \3%02d%s\3\t%s",
+			n, idColors[hits[n].id], idNames[hits[n].id], line->str
+		);
+	}
+	for (uint num = 0; num < count; ++num) {
+		bufferCool(windows[num]->buffer);
+	}
+	windowShow(windowFor(search));
+}
+
+void windowJump(size_t n) {
+	if (n >= hitsLen) return;
+	uint num = windowNumFor(hits[n].id);
+	if (num == count) return;
+	struct Window *window = windows[num];
+	unstale(window);
+	size_t len = hardLen(window);
+	for (size_t i = spillLen(window); i < len; ++i) {
+		if (hardLine(window, i)->line->num != hits[n].num) continue;
+		windowShow(num);
+		scrollTo(window, len - i);
+		return;
+	}
+	uiFormat(
+		Network, Warm, NULL, "Result %zu is no longer in \3%02d%s",
+		n, idColors[hits[n].id], idNames[hits[n].id]
+	);
 }
 
 static int writeString(FILE *file, const char *str) {
 	return (fwrite(str, strlen(str) + 1, 1, file) ? 0 : -1);
 }
 
+static int writeVarint(FILE *file, uint64_t u) {
+	for (; u >= 0x80; u >>= 7) {
+		if (putc(0x80 | (u & 0x7F), file) == EOF) return -1;
+	}
+	return (putc(u, file) == EOF ? -1 : 0);
+}
+
+// Line times are stored as the difference from the previous line, which
+// is usually small but can be negative.
+static uint64_t zigzag(int64_t n) {
+	return (uint64_t)n << 1 ^ (uint64_t)(n >> 63);
+}
+
+static int writeHeader(FILE *file, const struct Window *window) {
+	return 0
+		|| writeString(file, idNames[window->id])
+		|| writeVarint(file, window->mute)
+		|| writeVarint(file, window->time)
+		|| writeVarint(file, window->thresh)
+		|| writeVarint(file, window->heat)
+		|| writeVarint(file, window->unreadSoft)
+		|| writeVarint(file, window->unreadWarm);
+}
+
+static int writeBlock(FILE *file, const struct Window *window) {
+	char *block = NULL;
+	size_t len = 0;
+	FILE *stream = open_memstream(&block, &len);
+	if (!stream) return -1;
+	int error = 0
+		|| writeHeader(stream, window)
+		|| writeVarint(stream, bufferSoftLen(window->buffer));
+	time_t prev = 0;
+	for (size_t i = 0; !error && i < bufferSoftLen(window->buffer); ++i) {
+		const struct Line *line = bufferPeek(window->buffer, i);
+		error = 0
+			|| writeVarint(stream, zigzag(line->time - prev))
+			|| writeVarint(stream, line->heat)
+			|| writeString(stream, line->str);
+		prev = line->time;
+	}
+	error |= fclose(stream);
+	if (!error) {
+		error = 0
+			|| writeVarint(file, len)
+			|| !fwrite(block, len, 1, file);
+	}
+	free(block);
+	return error;
+}
+
 int windowSave(FILE *file) {
-	int error;
 	for (uint num = 0; num < count; ++num) {
 		const struct Window *window = windows[num];
-		error = 0
-			|| writeString(file, idNames[window->id])
-			|| writeTime(file, window->mute)
-			|| writeTime(file, window->time)
-			|| writeTime(file, window->thresh)
-			|| writeTime(file, window->heat)
-			|| writeTime(file, window->unreadSoft)
-			|| writeTime(file, window->unreadWarm);
-		if (error) return error;
-		for (size_t i = 0; i < BufferCap; ++i) {
-			const struct Line *line = bufferSoft(window->buffer, i);
-			if (!line) continue;
-			error = 0
-				|| writeTime(file, line->time)
-				|| writeTime(file, line->heat)
-				|| writeString(file, line->str);
-			if (error) return error;
-		}
-		error = writeTime(file, 0);
+		if (results(window->id)) continue;
+		int error = writeBlock(file, window);
+		bufferCool(window->buffer);
 		if (error) return error;
 	}
-	return writeString(file, "");
+	return writeVarint(file, 0);
 }
 
 static time_t readTime(FILE *file) {
@@ -650,9 +1379,192 @@ void windowLoad(FILE *file, size_t version) {
 			if (!time) break;
 			enum Heat heat = (version > 2 ? readTime(file) : Cold);
 			readString(file, &buf, &cap);
-			bufferPush(window->buffer, COLS, window->thresh, heat, time, buf);
+			bufferLoad(window->buffer, heat, time, buf);
+			window->stale = true;
 		}
-		reflow(window);
 	}
 	free(buf);
 }
+
+static uint64_t readVarint(const byte **ptr, const byte *end) {
+	uint64_t u = 0;
+	for (uint shift = 0; shift < 64; shift += 7) {
+		if (*ptr == end) errx(1, "truncated save file");
+		byte b = *(*ptr)++;
+		u |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return u;
+	}
+	errx(1, "malformed save file");
+}
+
+static const char *readField(const byte **ptr, const byte *end) {
+	const byte *nul = memchr(*ptr, '\0', end - *ptr);
+	if (!nul) errx(1, "truncated save file");
+	const char *str = (const char *)*ptr;
+	*ptr = nul + 1;
+	return str;
+}
+
+static struct Window *readHeader(const byte **ptr, const byte *end) {
+	struct Window *window = windows[windowFor(idFor(readField(ptr, end)))];
+	window->mute = readVarint(ptr, end);
+	window->time = readVarint(ptr, end);
+	window->thresh = readVarint(ptr, end);
+	window->heat = readVarint(ptr, end);
+	window->unreadSoft = readVarint(ptr, end);
+	window->unreadWarm = readVarint(ptr, end);
+	return window;
+}
+
+static void readBlock(const byte *ptr, const byte *end) {
+	struct Window *window = readHeader(&ptr, end);
+	uint64_t lines = readVarint(&ptr, end);
+	time_t time = 0;
+	while (lines--) {
+		uint64_t delta = readVarint(&ptr, end);
+		time += (int64_t)(delta >> 1 ^ -(delta & 1));
+		enum Heat heat = readVarint(&ptr, end);
+		const char *str = readField(&ptr, end);
+		bufferLoad(window->buffer, heat, time, str);
+		window->stale = true;
+	}
+}
+
+// Reads window blocks straight out of a mapped save file, returning the
+// number of bytes used.
+size_t windowUnpack(const byte *data, size_t size) {
+	const byte *ptr = data, *end = &data[size];
+	for (;;) {
+		uint64_t len = readVarint(&ptr, end);
+		if (!len) break;
+		if ((uint64_t)(end - ptr) < len) errx(1, "truncated save file");
+		readBlock(ptr, &ptr[len]);
+		ptr += len;
+	}
+	return ptr - data;
+}
+
+// The state of each window as last written to the journal.
+static struct Saved {
+	bool valid;
+	bool mute;
+	bool time;
+	enum Heat thresh;
+	enum Heat heat;
+	uint unreadSoft;
+	uint unreadWarm;
+} saved[IDCap];
+
+static uint savedOrder[IDCap];
+static uint savedCount;
+
+static bool savedEqual(const struct Window *window) {
+	const struct Saved *prev = &saved[window->id];
+	return prev->valid
+		&& prev->mute == window->mute
+		&& prev->time == window->time
+		&& prev->thresh == window->thresh
+		&& prev->heat == window->heat
+		&& prev->unreadSoft == window->unreadSoft
+		&& prev->unreadWarm == window->unreadWarm;
+}
+
+static void journalLine(
+	const struct Window *window, enum Heat heat, time_t time, const char *str
+) {
+	if (results(window->id)) return;
+	FILE *file = journalFile();
+	if (!file) return;
+	int error = 0
+		|| putc(EntryPush, file) == EOF
+		|| writeString(file, idNames[window->id])
+		|| writeVarint(file, heat)
+		|| writeVarint(file, time)
+		|| writeString(file, str);
+	if (error) err(1, "journal");
+}
+
+static int writeOrder(FILE *file) {
+	savedCount = 0;
+	for (uint num = 0; num < count; ++num) {
+		uint id = windows[num]->id;
+		if (!results(id)) savedOrder[savedCount++] = id;
+	}
+	int error = 0
+		|| putc(EntryOrder, file) == EOF
+		|| writeVarint(file, savedCount);
+	for (uint i = 0; i < savedCount; ++i) {
+		error = error || writeString(file, idNames[savedOrder[i]]);
+	}
+	return error;
+}
+
+// Closing is written right away, since replaying the lines of a window
+// creates it again.
+static void journalRemove(const struct Window *window) {
+	saved[window->id].valid = false;
+	FILE *file = journalFile();
+	if (!file) return;
+	int error = writeOrder(file);
+	if (error) err(1, "journal");
+}
+
+// Window state and order are otherwise only written when they have changed
+// since the last batch, so toggling back and forth costs nothing.
+void windowJournal(FILE *file) {
+	int error = 0;
+	uint len = 0;
+	bool moved = false;
+	for (uint num = 0; num < count; ++num) {
+		const struct Window *window = windows[num];
+		if (results(window->id)) continue;
+		if (len >= savedCount || savedOrder[len] != window->id) moved = true;
+		len++;
+		if (savedEqual(window)) continue;
+		saved[window->id] = (struct Saved) {
+			.valid = true,
+			.mute = window->mute,
+			.time = window->time,
+			.thresh = window->thresh,
+			.heat = window->heat,
+			.unreadSoft = window->unreadSoft,
+			.unreadWarm = window->unreadWarm,
+		};
+		error = error
+			|| putc(EntryWindow, file) == EOF
+			|| writeHeader(file, window);
+	}
+	if (moved || len != savedCount) error = error || writeOrder(file);
+	if (error) err(1, "journal");
+}
+
+static void replayPush(const byte **ptr, const byte *end) {
+	struct Window *window = windows[windowFor(idFor(readField(ptr, end)))];
+	enum Heat heat = readVarint(ptr, end);
+	time_t time = readVarint(ptr, end);
+	bufferLoad(window->buffer, heat, time, readField(ptr, end));
+	window->stale = true;
+}
+
+static void replayOrder(const byte **ptr, const byte *end) {
+	uint64_t len = readVarint(ptr, end);
+	for (uint64_t i = 0; i < len; ++i) {
+		uint num = windowFor(idFor(readField(ptr, end)));
+		if (num != i) windowInsert(i, windowRemove(num));
+	}
+	for (uint num = count; num-- > len;) {
+		if (windows[num]->id == Network) continue;
+		struct Window *window = windowRemove(num);
+		completeRemove(window->id, NULL);
+		windowFree(window);
+	}
+}
+
+void windowReplay(enum Entry entry, const byte **ptr, const byte *end) {
+	switch (entry) {
+		break; case EntryPush: replayPush(ptr, end);
+		break; case EntryWindow: readHeader(ptr, end);
+		break; case EntryOrder: replayOrder(ptr, end);
+		break; default: errx(1, "malformed save file");
+	}
+}